@@ -0,0 +1,174 @@
+#!/bin/sh
+# run by make check
+# trains the same trees with dt_train, --levelwise and --workers on generated
+# data and compares their predictions, which have to be identical. then
+# feeds broken model files to the loader, and kills a --workers run halfway
+
+DT=${DT:-./dt_main}
+dir=$(mktemp -d) || exit 1
+trap 'rm -rf "$dir"' EXIT
+fails=0
+
+fail() {
+    echo "FAIL $*"
+    fails=$((fails + 1))
+}
+
+# gen ROWS SEED HAS_Y
+# 6 numeric columns with a category code (0-11) in column 6, and the class
+# (0-2) last. the class depends on columns 0, 1 and the category, with some
+# noise. every 4th row repeats the one before it, so --dedup has rows to
+# collapse
+gen() {
+    awk -v n="$1" -v seed="$2" -v has_y="$3" 'BEGIN {
+        srand(seed)
+        for(i = 0; i < n; i++) {
+            if(i % 4 == 3) {
+                print line
+                continue
+            }
+            line = ""
+            for(c = 0; c < 6; c++) {
+                x[c] = int(rand() * 200) / 100 - 1
+                line = line x[c] ","
+            }
+            cat = int(rand() * 12)
+            line = line cat
+            if(has_y) {
+                y = (x[0] + x[1] > 0) + (cat % 3 == 0)
+                if(rand() < 0.1) {
+                    y = int(rand() * 3)
+                }
+                line = line "," y
+            }
+            print line
+        }
+    }'
+}
+
+# wide COLUMNS ROWS SEED HAS_Y
+# random values and 100 random classes, which makes the split statistics of
+# a node big enough that the wide levels are built a group of nodes at a time
+wide() {
+    awk -v cols="$1" -v n="$2" -v seed="$3" -v has_y="$4" 'BEGIN {
+        srand(seed)
+        for(i = 0; i < n; i++) {
+            line = ""
+            for(c = 0; c < cols; c++) {
+                line = line (c > 0 ? "," : "") int(rand() * 100) / 100
+            }
+            if(has_y) {
+                line = line "," int(rand() * 100)
+            }
+            print line
+        }
+    }'
+}
+
+gen 20000 1 1 > "$dir/train.csv"
+gen 2000 2 1 > "$dir/val.csv"
+gen 5000 3 0 > "$dir/test.csv"
+wide 200 3000 5 1 > "$dir/wide_train.csv"
+wide 200 300 6 1 > "$dir/wide_val.csv"
+wide 200 500 7 0 > "$dir/wide_test.csv"
+
+# predict DATA NAME [options] CRITERION
+# predicts the DATA test set into $dir/NAME.csv, returns 1 if dt_main fails
+predict() {
+    data=$1
+    name=$2
+    shift 2
+    if ! "$DT" "$@" noprune "$dir/${data}train.csv" "$dir/${data}val.csv" \
+            "$dir/${data}test.csv" "$dir/$name.csv" > "$dir/$name.log" 2>&1; then
+        fail "dt_main $* noprune exited with an error:"
+        cat "$dir/$name.log"
+        return 1
+    fi
+    return 0
+}
+
+for crit in gini entropy; do
+    for opts in "" "--categorical=6" "--dedup" "--dedup --categorical=6"; do
+        predict "" base $opts $crit || continue
+        for build in --levelwise --workers=1 --workers=2 --workers=3 --workers=8; do
+            predict "" other $build $opts $crit || continue
+            if cmp -s "$dir/base.csv" "$dir/other.csv"; then
+                echo "ok   $crit $opts $build"
+            else
+                fail "$crit $opts $build predicts differently from dt_train"
+            fi
+        done
+    done
+done
+
+if predict wide_ base gini; then
+    for build in --levelwise --workers=3; do
+        predict wide_ other $build gini || continue
+        if cmp -s "$dir/base.csv" "$dir/other.csv"; then
+            echo "ok   wide gini $build"
+        else
+            fail "wide gini $build predicts differently from dt_train"
+        fi
+    done
+fi
+
+# model files that are broken in the ways ft_load checks for
+if "$DT" train gini noprune "$dir/train.csv" "$dir/val.csv" "$dir/good.model" \
+        > "$dir/train.log" 2>&1; then
+    head -c 100 "$dir/good.model" > "$dir/truncated.model"
+    printf 'not a model' > "$dir/foreign.model"
+    cp "$dir/good.model" "$dir/trailing.model"
+    printf 'x' >> "$dir/trailing.model"
+    # the far child of the root, after the 16 byte header and its 4 byte value
+    cp "$dir/good.model" "$dir/corrupt.model"
+    printf '\377\377\377\377' | dd of="$dir/corrupt.model" bs=1 seek=20 conv=notrunc 2> /dev/null
+    for model in good truncated foreign trailing corrupt; do
+        "$DT" export "$dir/$model.model" "$dir/model.c" > "$dir/load.log" 2>&1
+        status=$?
+        if [ $model = good ] && [ $status -ne 0 ]; then
+            fail "a good model doesn't load"
+        elif [ $model != good ] && [ $status -eq 0 ]; then
+            fail "a $model model loads"
+        else
+            echo "ok   $model model"
+        fi
+    done
+else
+    fail "dt_main train exited with an error"
+fi
+
+# a --workers run that loses a worker has to fail without writing any
+# predictions. the training set is big enough to still be training when the
+# worker is found and killed
+if command -v pgrep > /dev/null; then
+    gen 400000 4 1 > "$dir/big.csv"
+    "$DT" --workers=2 gini noprune "$dir/big.csv" "$dir/val.csv" "$dir/test.csv" \
+        "$dir/dead.csv" > "$dir/dead.log" 2>&1 &
+    pid=$!
+    killed=0
+    while kill -0 $pid 2> /dev/null; do
+        worker=$(pgrep -P $pid | head -n 1)
+        if [ -n "$worker" ] && kill -9 "$worker" 2> /dev/null; then
+            killed=1
+            break
+        fi
+        sleep 0.05
+    done
+    wait $pid
+    status=$?
+    if [ $killed -eq 0 ]; then
+        echo "skip dead worker, training finished before a worker was seen"
+    elif [ $status -eq 0 ] || [ -e "$dir/dead.csv" ]; then
+        fail "a --workers run that lost a worker didn't fail"
+    else
+        echo "ok   dead worker"
+    fi
+else
+    echo "skip dead worker, needs pgrep"
+fi
+
+if [ $fails -gt 0 ]; then
+    echo "$fails checks failed"
+    exit 1
+fi
+echo "all checks passed"
@@ -0,0 +1,229 @@
+#define _POSIX_C_SOURCE 200809L
+
+// test client for `dt_main serve`
+// replays the rows of a csv file against a server socket from several
+// connections at once, and reports throughput and latency percentiles
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+typedef struct client_thread {
+    char *socket_path;
+    char **lines;
+    int linecount;
+    int first;
+    int step;
+    int depth;
+    int repeat;
+    // one latency per row sent, in microseconds
+    float *latencies;
+    int sent;
+    int errors;
+} client_thread;
+
+double now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+int connect_to(char *socket_path) {
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, socket_path, sizeof(addr.sun_path) - 1);
+    if(fd < 0 || connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        fprintf(stderr, "Unable to connect to '%s': %s\n", socket_path, strerror(errno));
+        if(fd >= 0) {
+            close(fd);
+        }
+        return -1;
+    }
+    return fd;
+}
+
+// sends `depth` rows at a time and waits for all of their replies
+void* client_run(void *arg) {
+    client_thread *ct = arg;
+    int fd = connect_to(ct->socket_path);
+    if(fd < 0) {
+        return NULL;
+    }
+
+    int mine = 0;
+    for(int i = ct->first; i < ct->linecount; i += ct->step) {
+        mine += 1;
+    }
+    ct->latencies = malloc((mine * ct->repeat + 1) * sizeof(float));
+
+    char reply[4096];
+    size_t outcap = 4096;
+    char *out = malloc(outcap);
+
+    for(int r = 0; r < ct->repeat; r++) {
+        int i = ct->first;
+        while(i < ct->linecount) {
+            size_t outlen = 0;
+            int n = 0;
+            while(n < ct->depth && i < ct->linecount) {
+                size_t len = strlen(ct->lines[i]);
+                if(outlen + len + 1 > outcap) {
+                    outcap = (outlen + len + 1) * 2;
+                    out = realloc(out, outcap);
+                }
+                memcpy(out + outlen, ct->lines[i], len);
+                out[outlen + len] = '\n';
+                outlen += len + 1;
+                n += 1;
+                i += ct->step;
+            }
+
+            double start = now_us();
+            size_t off = 0;
+            while(off < outlen) {
+                ssize_t w = write(fd, out + off, outlen - off);
+                if(w <= 0) {
+                    fprintf(stderr, "Lost connection to the server\n");
+                    goto done;
+                }
+                off += w;
+            }
+
+            int replies = 0;
+            while(replies < n) {
+                ssize_t got = read(fd, reply, sizeof(reply));
+                if(got <= 0) {
+                    fprintf(stderr, "Lost connection to the server\n");
+                    goto done;
+                }
+                for(ssize_t c = 0; c < got; c++) {
+                    if(reply[c] == '\n') {
+                        replies += 1;
+                    }
+                    else if(reply[c] == 'E') {
+                        ct->errors += 1;
+                    }
+                }
+            }
+
+            float us = now_us() - start;
+            for(int k = 0; k < n; k++) {
+                ct->latencies[ct->sent] = us;
+                ct->sent += 1;
+            }
+        }
+    }
+
+done:
+    free(out);
+    close(fd);
+    return NULL;
+}
+
+int compare_floats(const void *a, const void *b) {
+    float fa = *(const float*)a;
+    float fb = *(const float*)b;
+    return (fa > fb) - (fa < fb);
+}
+
+int main(int argc, char *argv[]) {
+    if(argc < 3 || argc > 6) {
+        fprintf(stderr, "Usage: %s <socket> <csv> [connections] [pipeline depth] [repeat]\n", argv[0]);
+        return 1;
+    }
+
+    int connections = argc > 3 ? atoi(argv[3]) : 4;
+    int depth = argc > 4 ? atoi(argv[4]) : 1;
+    int repeat = argc > 5 ? atoi(argv[5]) : 1;
+    if(connections < 1 || depth < 1 || repeat < 1) {
+        fprintf(stderr, "connections, depth and repeat must be positive\n");
+        return 1;
+    }
+
+    FILE *f = fopen(argv[2], "r");
+    if(!f) {
+        fprintf(stderr, "Unable to open file '%s'\n", argv[2]);
+        return 1;
+    }
+
+    int linecap = 1024;
+    int linecount = 0;
+    char **lines = malloc(linecap * sizeof(char*));
+    char *line = NULL;
+    size_t len = 0;
+    ssize_t got;
+    while((got = getline(&line, &len, f)) > 0) {
+        while(got > 0 && (line[got-1] == '\n' || line[got-1] == '\r')) {
+            line[--got] = '\0';
+        }
+        if(got == 0) {
+            continue;
+        }
+        if(linecount == linecap) {
+            linecap *= 2;
+            lines = realloc(lines, linecap * sizeof(char*));
+        }
+        lines[linecount] = strdup(line);
+        linecount += 1;
+    }
+    free(line);
+    fclose(f);
+
+    client_thread *threads = calloc(connections, sizeof(client_thread));
+    pthread_t *ids = malloc(connections * sizeof(pthread_t));
+
+    double start = now_us();
+    for(int i = 0; i < connections; i++) {
+        threads[i].socket_path = argv[1];
+        threads[i].lines = lines;
+        threads[i].linecount = linecount;
+        threads[i].first = i;
+        threads[i].step = connections;
+        threads[i].depth = depth;
+        threads[i].repeat = repeat;
+        pthread_create(&ids[i], NULL, client_run, &threads[i]);
+    }
+
+    int total = 0;
+    int errors = 0;
+    for(int i = 0; i < connections; i++) {
+        pthread_join(ids[i], NULL);
+        total += threads[i].sent;
+        errors += threads[i].errors;
+    }
+    double elapsed = now_us() - start;
+
+    float *all = malloc((total + 1) * sizeof(float));
+    int n = 0;
+    for(int i = 0; i < connections; i++) {
+        memcpy(all + n, threads[i].latencies, threads[i].sent * sizeof(float));
+        n += threads[i].sent;
+        free(threads[i].latencies);
+    }
+
+    if(total == 0) {
+        fprintf(stderr, "No rows were classified\n");
+        return 1;
+    }
+
+    qsort(all, total, sizeof(float), compare_floats);
+    printf("Sent %d rows over %d connections (depth %d) in %.3f s\n",
+            total, connections, depth, elapsed / 1e6);
+    printf("Throughput: %.0f rows/s\n", total / (elapsed / 1e6));
+    printf("Latency p50: %.1f us, p99: %.1f us\n",
+            all[(total - 1) / 2], all[(int)((total - 1) * 0.99)]);
+    if(errors > 0) {
+        printf("%d rows were rejected by the server\n", errors);
+    }
+
+    free(all);
+    return 0;
+}
@@ -0,0 +1,170 @@
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "cross_validate.h"
+
+typedef struct cv_state {
+    data_set *data;
+    dt_options *opts;
+    dt_cv_result *result;
+    int k;
+    // shuffled row indices, fold f is perm[fold_start[f]] up to fold_start[f+1]
+    unsigned int *perm;
+    unsigned int *fold_start;
+    pthread_mutex_t lock;
+    int next_fold;
+} cv_state;
+
+void* cv_worker(void *arg);
+
+void dt_default_options(dt_options *opts) {
+    opts->criterion = CR_GINI;
+    opts->prune = 0;
+    opts->seed = 0;
+    opts->threads = 0;
+}
+
+dt_cv_result* dt_cross_validate(data_set *data, int k, dt_options *opts) {
+    if(!data->has_ydata) {
+        fprintf(stderr, "Cross-validation requires y data!\n");
+        return NULL;
+    }
+    if(k < 2 || k > data->rowcount) {
+        fprintf(stderr, "Can't make %d folds out of %u rows\n", k, data->rowcount);
+        return NULL;
+    }
+
+    dt_cv_result *result = malloc(sizeof(dt_cv_result));
+    result->k = k;
+    result->fold_scores = malloc(k * sizeof(float));
+    result->fold_nodes = malloc(k * sizeof(int));
+
+    cv_state state;
+    state.data = data;
+    state.opts = opts;
+    state.result = result;
+    state.k = k;
+    state.next_fold = 0;
+    pthread_mutex_init(&state.lock, NULL);
+
+    // fisher-yates shuffle with a private xorshift generator, so the folds
+    // only depend on the seed
+    unsigned int n = data->rowcount;
+    uint32_t rng = opts->seed != 0 ? opts->seed : (uint32_t)time(NULL);
+    if(rng == 0) {
+        rng = 1;
+    }
+    state.perm = malloc(n * sizeof(unsigned int));
+    for(unsigned int i = 0; i < n; i++) {
+        state.perm[i] = i;
+    }
+    for(unsigned int i = n - 1; i > 0; i--) {
+        rng ^= rng << 13;
+        rng ^= rng >> 17;
+        rng ^= rng << 5;
+        unsigned int j = rng % (i + 1);
+        unsigned int tmp = state.perm[i];
+        state.perm[i] = state.perm[j];
+        state.perm[j] = tmp;
+    }
+
+    state.fold_start = malloc((k + 1) * sizeof(unsigned int));
+    for(int f = 0; f <= k; f++) {
+        state.fold_start[f] = (unsigned long)n * f / k;
+    }
+
+    int threads = opts->threads > 0 && opts->threads < k ? opts->threads : k;
+    pthread_t *ids = malloc(threads * sizeof(pthread_t));
+    for(int t = 0; t < threads; t++) {
+        pthread_create(&ids[t], NULL, cv_worker, &state);
+    }
+    for(int t = 0; t < threads; t++) {
+        pthread_join(ids[t], NULL);
+    }
+    free(ids);
+
+    double mean = 0;
+    for(int f = 0; f < k; f++) {
+        mean += result->fold_scores[f];
+    }
+    mean /= k;
+    double variance = 0;
+    for(int f = 0; f < k; f++) {
+        double diff = result->fold_scores[f] - mean;
+        variance += diff * diff;
+    }
+    result->mean_score = mean;
+    result->stddev_score = sqrt(variance / k);
+
+    pthread_mutex_destroy(&state.lock);
+    free(state.perm);
+    free(state.fold_start);
+    return result;
+}
+
+void dt_cv_free(dt_cv_result *result) {
+    if(result == NULL) {
+        return;
+    }
+    free(result->fold_scores);
+    free(result->fold_nodes);
+    free(result);
+}
+
+// private function, trains and scores folds until there are none left
+void* cv_worker(void *arg) {
+    cv_state *state = arg;
+    unsigned int n = state->data->rowcount;
+    unsigned int *train_rows = malloc(n * sizeof(unsigned int));
+
+    while(1) {
+        pthread_mutex_lock(&state->lock);
+        int f = state->next_fold;
+        state->next_fold += 1;
+        pthread_mutex_unlock(&state->lock);
+        if(f >= state->k) {
+            break;
+        }
+
+        unsigned int start = state->fold_start[f];
+        unsigned int end = state->fold_start[f + 1];
+        unsigned int *fold_rows = state->perm + start;
+        unsigned int fold_count = end - start;
+
+        // everything outside of the fold, in shuffled order
+        unsigned int train_count = 0;
+        for(unsigned int i = 0; i < n; i++) {
+            if(i < start || i >= end) {
+                train_rows[train_count] = state->perm[i];
+                train_count += 1;
+            }
+        }
+
+        // pruning against the held-out fold would tune the tree to the rows
+        // it is scored on, so a fold's worth of the training rows is set
+        // aside to prune against instead
+        unsigned int prune_count = 0;
+        if(state->opts->prune && train_count > 1) {
+            prune_count = train_count / (state->k - 1);
+            prune_count = prune_count < 1 ? 1 : prune_count;
+            prune_count = prune_count >= train_count ? train_count - 1 : prune_count;
+        }
+        train_count -= prune_count;
+
+        decision_tree *dt = dt_new(state->opts->seed, state->opts->criterion);
+        dt_train_rows(dt, state->data, train_rows, train_count);
+        if(prune_count > 0) {
+            dt_prune_rows(dt, state->data, train_rows + train_count, prune_count);
+        }
+
+        state->result->fold_scores[f] = dt_score_rows(dt, state->data, fold_rows, fold_count);
+        state->result->fold_nodes[f] = dt_node_count(dt);
+        dt_free(dt);
+    }
+
+    free(train_rows);
+    return NULL;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include "decision_tree.h"
+
+// how trees are trained by the multi-tree functions
+typedef struct dt_options {
+    split_criterion criterion;
+    // set a fold's worth of every tree's training rows aside, and prune the
+    // tree trained on the rest against them
+    int prune;
+    // used for dt_new and for shuffling rows, 0 means the current time
+    unsigned int seed;
+    // the most trees trained at once, 0 means one thread per tree
+    int threads;
+} dt_options;
+
+typedef struct dt_cv_result {
+    int k;
+    // dt_score of every fold's tree on its held-out rows
+    float *fold_scores;
+    // dt_node_count of every fold's tree
+    int *fold_nodes;
+    float mean_score;
+    float stddev_score;
+} dt_cv_result;
+
+// gini, no pruning, random seed, one thread per tree
+void dt_default_options(dt_options *opts);
+
+// k-fold cross-validation of the tree options on data, which REQUIRES y data
+// the rows are shuffled once and dealt into k folds. each fold's tree is
+// trained on the other k-1 folds and scored on the fold itself. the folds are
+// trained concurrently on row index lists into data, so it is never copied
+// returns NULL if k is out of range, free the result with dt_cv_free
+dt_cv_result* dt_cross_validate(data_set *data, int k, dt_options *opts);
+void dt_cv_free(dt_cv_result *result);
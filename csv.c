@@ -1,66 +1,313 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include "csv.h"
+#include "reader.h"
+#include <glob.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-
-void split_line(char *line, float *floatbuf, int buflen, int *ncols);
-int count_columns(FILE *csvfile);
+#include <unistd.h>
+#include <sys/stat.h>
+
+// files are split into byte ranges of about this size, at least
+#define CSV_MIN_CHUNK (1 << 20)
+
+// a byte range of one file, parsed by one worker into its own rows
+// an end of -1 means the whole file, read through a reader
+typedef struct csv_chunk {
+    char *filename;
+    long start;
+    long end;
+    unsigned int rowcount;
+    unsigned int rowcap;
+    float **rows;
+    // rows (indices into rows) with the wrong number of columns
+    unsigned int badcount;
+    unsigned int *bad;
+    int *bad_ncols;
+    int failed;
+} csv_chunk;
+
+typedef struct csv_jobs {
+    csv_chunk *chunks;
+    int count;
+    unsigned int colcount;
+    pthread_mutex_t lock;
+    int next;
+} csv_jobs;
+
+int count_columns(char *filename);
+void* csv_worker(void *arg);
+void csv_parse_chunk(csv_chunk *chunk, unsigned int colcount);
+void csv_parse_line(csv_chunk *chunk, char *line, unsigned int colcount);
+csv_file* csv_stitch(csv_jobs *jobs, char *filename);
 
 csv_file* csv_new(char *filename) {
-    int len = strlen(filename);
-    csv_file *csv = malloc(sizeof(csv_file));
-    csv->filename = malloc(len+1);
-    memcpy(csv->filename, filename, len+1);
+    int colcount = count_columns(filename);
+    if(colcount < 0) {
+        return NULL;
+    }
 
-    FILE *f = fopen(csv->filename, "r");
+    csv_jobs jobs;
+    jobs.colcount = colcount;
+    jobs.chunks = calloc(1, sizeof(csv_chunk));
+    jobs.count = 1;
+    jobs.chunks[0].filename = filename;
+    jobs.chunks[0].end = -1;
+    csv_parse_chunk(&jobs.chunks[0], colcount);
+    return csv_stitch(&jobs, filename);
+}
 
-    if(!f) {
-        fprintf(stderr, "Unable to open file '%s'\n", csv->filename);
+csv_file* csv_new_files(char **filenames, int filecount, int threads) {
+    if(filecount < 1) {
+        fprintf(stderr, "No CSV files to read\n");
         return NULL;
     }
+    if(threads < 1) {
+        threads = sysconf(_SC_NPROCESSORS_ONLN);
+        if(threads < 1) {
+            threads = 1;
+        }
+    }
 
+    // every file has to exist before any work starts
+    // compressed files can't be split, they are read whole with a size of -1
+    long total = 0;
+    long *sizes = malloc(filecount * sizeof(long));
+    for(int i = 0; i < filecount; i++) {
+        struct stat st;
+        int compression = rd_detect(filenames[i]);
+        if(compression < 0 || stat(filenames[i], &st) != 0) {
+            fprintf(stderr, "Unable to open file '%s'\n", filenames[i]);
+            free(sizes);
+            return NULL;
+        }
+        sizes[i] = compression == RD_PLAIN ? st.st_size : -1;
+        total += st.st_size;
+    }
 
-    csv->colcount = count_columns(f);
-    csv->rowcount = 0;
+    csv_jobs jobs;
+    int colcount = count_columns(filenames[0]);
+    if(colcount < 0) {
+        free(sizes);
+        return NULL;
+    }
+    jobs.colcount = colcount;
 
-    char buf[4096];
-    int ncols;
-    int curlines = 1;
-    float **data = malloc(curlines * sizeof(float*));
-    data[0] = malloc(csv->colcount * sizeof(float));
-    while(!feof(f)) {
-        if(fscanf(f, "%4096s", buf) != 1) {
+    // a few chunks per thread, so that uneven shards still balance out
+    long chunksize = total / (threads * 4) + 1;
+    if(chunksize < CSV_MIN_CHUNK) {
+        chunksize = CSV_MIN_CHUNK;
+    }
+    int cap = 0;
+    for(int i = 0; i < filecount; i++) {
+        cap += sizes[i] < 0 ? 1 : sizes[i] / chunksize + 1;
+    }
+    jobs.chunks = calloc(cap, sizeof(csv_chunk));
+    jobs.count = 0;
+    for(int i = 0; i < filecount; i++) {
+        int pieces = sizes[i] < 0 ? 1 : sizes[i] / chunksize + 1;
+        for(int p = 0; p < pieces; p++) {
+            csv_chunk *chunk = &jobs.chunks[jobs.count];
+            chunk->filename = filenames[i];
+            chunk->start = sizes[i] < 0 ? 0 : sizes[i] * p / pieces;
+            chunk->end = sizes[i] < 0 ? -1 : sizes[i] * (p + 1) / pieces;
+            jobs.count += 1;
+        }
+    }
+    free(sizes);
+
+    jobs.next = 0;
+    pthread_mutex_init(&jobs.lock, NULL);
+    if(threads > jobs.count) {
+        threads = jobs.count;
+    }
+    pthread_t *ids = malloc(threads * sizeof(pthread_t));
+    for(int t = 0; t < threads; t++) {
+        pthread_create(&ids[t], NULL, csv_worker, &jobs);
+    }
+    for(int t = 0; t < threads; t++) {
+        pthread_join(ids[t], NULL);
+    }
+    free(ids);
+    pthread_mutex_destroy(&jobs.lock);
+
+    return csv_stitch(&jobs, filenames[0]);
+}
+
+csv_file* csv_new_list(char *list, int threads) {
+    int count = 0;
+    int cap = 16;
+    char **filenames = malloc(cap * sizeof(char*));
+    char *copy = malloc(strlen(list) + 1);
+    strcpy(copy, list);
+
+    char *save;
+    for(char *item = strtok_r(copy, ",", &save); item != NULL; item = strtok_r(NULL, ",", &save)) {
+        glob_t g;
+        int found = glob(item, 0, NULL, &g);
+        // a plain file name that doesn't exist is reported by the loader
+        if(found != 0 && (found != GLOB_NOMATCH || strpbrk(item, "*?[") != NULL)) {
+            fprintf(stderr, "No files match '%s'\n", item);
+            count = -1;
             break;
         }
 
-        if(csv->rowcount >= curlines) {
-            data = realloc(data, curlines*2*sizeof(float*));
-            for(int i = curlines; i < curlines*2; i++) {
-                data[i] = malloc(csv->colcount * sizeof(float));
-            }
-            curlines *= 2;
+        int matches = found == 0 ? g.gl_pathc : 1;
+        while(count + matches > cap) {
+            cap *= 2;
+            filenames = realloc(filenames, cap * sizeof(char*));
+        }
+        for(int i = 0; i < matches; i++) {
+            char *name = found == 0 ? g.gl_pathv[i] : item;
+            filenames[count] = malloc(strlen(name) + 1);
+            strcpy(filenames[count], name);
+            count += 1;
+        }
+        if(found == 0) {
+            globfree(&g);
         }
+    }
 
-        split_line(buf, data[csv->rowcount], csv->colcount, &ncols);
-        csv->rowcount += 1;
+    csv_file *csv = NULL;
+    if(count >= 0) {
+        csv = csv_new_files(filenames, count, threads);
+    }
+    for(int i = 0; i < count; i++) {
+        free(filenames[i]);
+    }
+    free(filenames);
+    free(copy);
+    return csv;
+}
 
-        if(ncols != csv->colcount) {
+// private function, parses chunks until there are none left
+void* csv_worker(void *arg) {
+    csv_jobs *jobs = arg;
+    while(1) {
+        pthread_mutex_lock(&jobs->lock);
+        int c = jobs->next;
+        jobs->next += 1;
+        pthread_mutex_unlock(&jobs->lock);
+        if(c >= jobs->count) {
+            break;
+        }
+        csv_parse_chunk(&jobs->chunks[c], jobs->colcount);
+    }
+    return NULL;
+}
+
+// private function, stitches the parsed chunks together in file order
+// and frees them
+csv_file* csv_stitch(csv_jobs *jobs, char *filename) {
+    csv_file *csv = malloc(sizeof(csv_file));
+    int len = strlen(filename);
+    csv->filename = malloc(len + 1);
+    memcpy(csv->filename, filename, len + 1);
+    csv->colcount = jobs->colcount;
+    csv->rowcount = 0;
+    int failed = 0;
+    for(int c = 0; c < jobs->count; c++) {
+        csv->rowcount += jobs->chunks[c].rowcount;
+        failed = failed || jobs->chunks[c].failed;
+    }
+    csv->data = malloc((csv->rowcount + 1) * sizeof(float*));
+
+    unsigned int row = 0;
+    for(int c = 0; c < jobs->count; c++) {
+        csv_chunk *chunk = &jobs->chunks[c];
+        // rows of a file that failed part way through are garbage anyway
+        for(unsigned int b = 0; !failed && b < chunk->badcount; b++) {
             fprintf(stderr, "Warning! Expected %d columns, got %d on line %d\n",
-                    csv->colcount, ncols, csv->rowcount);
+                    csv->colcount, chunk->bad_ncols[b], row + chunk->bad[b] + 1);
         }
+        memcpy(csv->data + row, chunk->rows, chunk->rowcount * sizeof(float*));
+        row += chunk->rowcount;
+        free(chunk->rows);
+        free(chunk->bad);
+        free(chunk->bad_ncols);
     }
+    free(jobs->chunks);
 
-    csv->data = malloc(csv->rowcount * sizeof(float*));
-    for(int i = 0; i < csv->rowcount; i++) {
-        csv->data[i] = data[i];
+    if(failed) {
+        csv_free(csv);
+        return NULL;
+    }
+    return csv;
+}
+
+// private function, reads the lines that start inside the chunk's byte range
+// or, for an end of -1, every line of the (possibly compressed) file
+void csv_parse_chunk(csv_chunk *chunk, unsigned int colcount) {
+    char *line = NULL;
+    size_t linecap = 0;
+
+    if(chunk->end < 0) {
+        reader *rd = rd_open(chunk->filename);
+        if(rd == NULL) {
+            chunk->failed = 1;
+            return;
+        }
+        while(rd_getline(rd, &line, &linecap) > 0) {
+            csv_parse_line(chunk, line, colcount);
+        }
+        chunk->failed = rd_close(rd) != 0;
+        free(line);
+        return;
+    }
+
+    FILE *f = fopen(chunk->filename, "r");
+    if(!f) {
+        fprintf(stderr, "Unable to open file '%s'\n", chunk->filename);
+        chunk->failed = 1;
+        return;
     }
 
-    for(int i = csv->rowcount; i < curlines; i++) {
-        free(data[i]);
+    ssize_t n;
+    long pos = 0;
+
+    // the line that straddles the start belongs to the previous chunk
+    if(chunk->start > 0) {
+        fseek(f, chunk->start - 1, SEEK_SET);
+        pos = chunk->start - 1;
+        n = getline(&line, &linecap, f);
+        pos += n > 0 ? n : 0;
     }
-    free(data);
+
+    while(pos < chunk->end && (n = getline(&line, &linecap, f)) > 0) {
+        pos += n;
+        csv_parse_line(chunk, line, colcount);
+    }
+
+    free(line);
     fclose(f);
-    return csv;
+}
+
+// private function, adds the rows of one line to the chunk
+// every whitespace separated token is a row
+void csv_parse_line(csv_chunk *chunk, char *line, unsigned int colcount) {
+    char *save;
+    for(char *token = strtok_r(line, " \t\r\n\v\f", &save); token != NULL;
+            token = strtok_r(NULL, " \t\r\n\v\f", &save)) {
+        if(chunk->rowcount == chunk->rowcap) {
+            chunk->rowcap = chunk->rowcap > 0 ? chunk->rowcap * 2 : 1024;
+            chunk->rows = realloc(chunk->rows, chunk->rowcap * sizeof(float*));
+        }
+
+        int ncols;
+        float *row = malloc(colcount * sizeof(float));
+        csv_split_line(token, row, colcount, &ncols);
+        if(ncols != colcount) {
+            chunk->bad = realloc(chunk->bad, (chunk->badcount + 1) * sizeof(unsigned int));
+            chunk->bad_ncols = realloc(chunk->bad_ncols, (chunk->badcount + 1) * sizeof(int));
+            chunk->bad[chunk->badcount] = chunk->rowcount;
+            chunk->bad_ncols[chunk->badcount] = ncols;
+            chunk->badcount += 1;
+        }
+        chunk->rows[chunk->rowcount] = row;
+        chunk->rowcount += 1;
+    }
 }
 
 void csv_free(csv_file *csv) {
@@ -138,7 +385,7 @@ float csv_col_variance(csv_file *csv, int col) {
 }
 
 
-void split_line(char *line, float *buf, int buflen, int *ncols) {
+void csv_split_line(char *line, float *buf, int buflen, int *ncols) {
     float val;
     char *pos = line;
     char *tmppos;
@@ -169,21 +416,34 @@ void split_line(char *line, float *buf, int buflen, int *ncols) {
 }
 
 
-int count_columns(FILE *csvfile) {
-    char line[4096];
-
-    if(fscanf(csvfile, "%4096s", line) != 1) {
-        fseek(csvfile, 0, SEEK_SET);
-        return 0;
+// private function, the number of columns in the first row of the file
+// returns -1 if the file can't be read
+int count_columns(char *filename) {
+    reader *rd = rd_open(filename);
+    if(rd == NULL) {
+        return -1;
     }
 
-    int c = 0;
-    for(int i = 0; i < strlen(line); i++) {
-        if(line[i] == ',') {
+    char *line = NULL;
+    size_t linecap = 0;
+    int c = -1;
+    while(c < 0 && rd_getline(rd, &line, &linecap) > 0) {
+        char *save;
+        char *token = strtok_r(line, " \t\r\n\v\f", &save);
+        if(token == NULL) {
+            continue;
+        }
+        c = 0;
+        for(char *comma = strchr(token, ','); comma != NULL; comma = strchr(comma + 1, ',')) {
             c += 1;
         }
     }
-    fseek(csvfile, 0, SEEK_SET);
+    free(line);
+    // only the first row is read, the decompressor is stopped early and
+    // only fails if it already ran into corrupt data
+    if(rd_close(rd) != 0) {
+        return -1;
+    }
     // turns out that little +1 is really important...
     return c+1;
 }
@@ -14,6 +14,20 @@ typedef struct csv_file {
 csv_file* csv_new(char *filename);
 void csv_free(csv_file *csv);
 
+// read several files as if they were one file, with their rows in order
+// the files are split into byte ranges at line boundaries, which `threads`
+// worker threads (0 means one per CPU) parse at the same time. the column
+// count comes from the first file
+csv_file* csv_new_files(char **filenames, int filecount, int threads);
+
+// csv_new_files on a comma separated list of file names and glob patterns,
+// like "day1.csv,shards/part-*.csv". the matches of a pattern are sorted
+csv_file* csv_new_list(char *list, int threads);
+
+// parse one line of comma separated floats into buf
+// at most buflen values are read, ncols is set to the number read
+void csv_split_line(char *line, float *buf, int buflen, int *ncols);
+
 // calculate the (min|max|mean|var) of the specified column
 float csv_col_min(csv_file *csv, int col);
 float csv_col_max(csv_file *csv, int col);
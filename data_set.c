@@ -1,4 +1,5 @@
 #include "data_set.h"
+#include "impurity.h"
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -14,6 +15,8 @@ data_set* ds_new(unsigned int colcount, int has_ydata) {
     ds->rowcapacity = 0;
     ds->x_data = NULL;
     ds->y_data = NULL;
+    ds->weights = NULL;
+    ds->categorical = NULL;
     return ds;
 }
 
@@ -52,6 +55,21 @@ void ds_free(data_set *ds) {
 
     free(ds->x_data);
     free(ds->y_data);
+    free(ds->weights);
+    free(ds->categorical);
+}
+
+int ds_set_categorical(data_set *ds, unsigned int col) {
+    if(col >= ds->colcount) {
+        fprintf(stderr, "Can't make column %u categorical (range is 0-%d)\n",
+                col, ds->colcount - 1);
+        return -1;
+    }
+    if(ds->categorical == NULL) {
+        ds->categorical = calloc(ds->colcount, 1);
+    }
+    ds->categorical[col] = 1;
+    return 0;
 }
 
 void ds_resize(data_set *ds) {
@@ -63,6 +81,9 @@ void ds_resize(data_set *ds) {
 
     ds->x_data = realloc(ds->x_data, ds->rowcapacity * sizeof(float*));
     ds->y_data = realloc(ds->y_data, ds->rowcapacity * sizeof(float));
+    if(ds->weights != NULL) {
+        ds->weights = realloc(ds->weights, ds->rowcapacity * sizeof(float));
+    }
 
     for(int i = ds->rowcount; i < ds->rowcapacity; i++) {
         ds->x_data[i] = malloc(ds->colcount * sizeof(float));
@@ -74,18 +95,136 @@ void ds_add_item(data_set *ds, float *x, float y) {
 
     memcpy(ds->x_data[ds->rowcount], x, ds->colcount * sizeof(float));
     ds->y_data[ds->rowcount] = y;
+    if(ds->weights != NULL) {
+        ds->weights[ds->rowcount] = 1;
+    }
 
     ds->rowcount += 1;
 }
 
+void ds_add_weighted_item(data_set *ds, float *x, float y, float weight) {
+    if(ds->weights == NULL && weight != 1) {
+        // switch from implicit to explicit weights
+        ds->weights = malloc((ds->rowcapacity + 1) * sizeof(float));
+        for(int i = 0; i < ds->rowcapacity; i++) {
+            ds->weights[i] = 1;
+        }
+    }
+
+    ds_add_item(ds, x, y);
+    if(ds->weights != NULL) {
+        ds->weights[ds->rowcount - 1] = weight;
+    }
+}
+
+double ds_total_weight(data_set *ds) {
+    if(ds->weights == NULL) {
+        return ds->rowcount;
+    }
+
+    double total = 0;
+    for(int i = 0; i < ds->rowcount; i++) {
+        total += ds->weights[i];
+    }
+    return total;
+}
+
+// private function, FNV-1a over the bytes of a row and its y value
+unsigned long ds_hash_row(data_set *ds, unsigned int row) {
+    unsigned long hash = 14695981039346656037UL;
+    unsigned char *bytes = (unsigned char*)ds->x_data[row];
+    for(size_t i = 0; i < ds->colcount * sizeof(float); i++) {
+        hash = (hash ^ bytes[i]) * 1099511628211UL;
+    }
+    if(ds->has_ydata) {
+        bytes = (unsigned char*)&ds->y_data[row];
+        for(size_t i = 0; i < sizeof(float); i++) {
+            hash = (hash ^ bytes[i]) * 1099511628211UL;
+        }
+    }
+    return hash;
+}
+
+int ds_rows_equal(data_set *ds, unsigned int a, unsigned int b) {
+    if(ds->has_ydata && memcmp(&ds->y_data[a], &ds->y_data[b], sizeof(float)) != 0) {
+        return 0;
+    }
+    return memcmp(ds->x_data[a], ds->x_data[b], ds->colcount * sizeof(float)) == 0;
+}
+
+unsigned int ds_dedup(data_set *ds) {
+    if(ds->rowcount < 2) {
+        return 0;
+    }
+
+    // open addressing table of kept row indices, at most half full
+    unsigned long tablesize = 1;
+    while(tablesize < 2UL * ds->rowcount) {
+        tablesize *= 2;
+    }
+    unsigned int empty = ds->rowcount;
+    unsigned int *table = malloc(tablesize * sizeof(unsigned int));
+    for(unsigned long i = 0; i < tablesize; i++) {
+        table[i] = empty;
+    }
+
+    float *weights = malloc(ds->rowcount * sizeof(float));
+    unsigned int kept = 0;
+    for(unsigned int row = 0; row < ds->rowcount; row++) {
+        unsigned long slot = ds_hash_row(ds, row) & (tablesize - 1);
+        while(table[slot] != empty && !ds_rows_equal(ds, table[slot], row)) {
+            slot = (slot + 1) & (tablesize - 1);
+        }
+
+        if(table[slot] != empty) {
+            weights[table[slot]] += ds_weight(ds, row);
+            free(ds->x_data[row]);
+            continue;
+        }
+
+        // rows move down to the front as duplicates are dropped, the table
+        // points at their new position
+        weights[kept] = ds_weight(ds, row);
+        ds->x_data[kept] = ds->x_data[row];
+        if(ds->has_ydata) {
+            ds->y_data[kept] = ds->y_data[row];
+        }
+        table[slot] = kept;
+        kept += 1;
+    }
+    free(table);
+
+    // the spare rows past rowcount are owned by the data set too
+    for(unsigned int i = ds->rowcount; i < ds->rowcapacity; i++) {
+        free(ds->x_data[i]);
+    }
+
+    unsigned int removed = ds->rowcount - kept;
+    ds->rowcount = kept;
+    ds->rowcapacity = kept;
+    ds->x_data = realloc(ds->x_data, kept * sizeof(float*));
+    if(ds->y_data != NULL) {
+        ds->y_data = realloc(ds->y_data, kept * sizeof(float));
+    }
+    free(ds->weights);
+    ds->weights = realloc(weights, kept * sizeof(float));
+    return removed;
+}
+
 
 float ds_col_mean(data_set *ds, unsigned int col) {
     double mean = 0;
-    for(int i = 0; i < ds->rowcount; i++) {
-        mean += ds->x_data[i][col];
+    if(ds->weights == NULL) {
+        for(int i = 0; i < ds->rowcount; i++) {
+            mean += ds->x_data[i][col];
+        }
+        return (float)(mean / ds->rowcount);
     }
 
-    return (float)(mean / ds->rowcount);
+    for(int i = 0; i < ds->rowcount; i++) {
+        mean += (double)ds->weights[i] * ds->x_data[i][col];
+    }
+    return (float)(mean / ds_total_weight(ds));
 }
 
 float ds_col_variance(data_set *ds, unsigned int col) {
@@ -144,32 +283,21 @@ float ds_entropy(data_set *ds) {
         return 0.0;
     }
 
-    int total = ds->rowcount;
+    float total = ds_total_weight(ds);
     int classcount = 0;
     float *classes = ds_classes(ds, &classcount);
-    int *classcounts = malloc(classcount * sizeof(int));
-    memset(classcounts, 0, classcount * sizeof(int));
+    float *classcounts = calloc(classcount + 1, sizeof(float));
 
     for(int i = 0; i < ds->rowcount; i++) {
         float val = ds->y_data[i];
         for(int j = 0; j < classcount; j++) {
             if(val == classes[j]) {
-                classcounts[j] += 1;
+                classcounts[j] += ds_weight(ds, i);
             }
         }
     }
 
-    float entropy = 0.0;
-    for(int i = 0; i < classcount; i++) {
-        float frac = ((float)classcounts[i]) / total;
-        float logfrac = 0.0;
-        if(frac != 0.0) {
-            logfrac = log(frac) / log(2);
-        }
-        entropy += frac * logfrac;
-    }
-    entropy *= -1;
-
+    float entropy = ds_entropy_counts(classcounts, classcount, total);
     free(classes);
     free(classcounts);
     return entropy;
@@ -182,30 +310,30 @@ float ds_gini(data_set *ds) {
         return 0.0;
     }
 
-    int total = ds->rowcount;
+    float total = ds_total_weight(ds);
     int classcount = 0;
     float *classes = ds_classes(ds, &classcount);
-    int *classcounts = malloc(classcount * sizeof(int));
-    memset(classcounts, 0, classcount * sizeof(int));
+    float *classcounts = calloc(classcount + 1, sizeof(float));
 
     for(int i = 0; i < ds->rowcount; i++) {
         float val = ds->y_data[i];
         for(int j = 0; j < classcount; j++) {
             if(val == classes[j]) {
-                classcounts[j] += 1;
+                classcounts[j] += ds_weight(ds, i);
             }
         }
     }
 
-    float gini = 0.0;
-    for(int i = 0; i < classcount; i++) {
-        float frac = ((float)classcounts[i]) / total;
-        gini += frac * frac;
-    }
-
+    float gini = ds_gini_counts(classcounts, classcount, total);
     free(classes);
     free(classcounts);
     return gini;
 }
 
+float ds_entropy_counts(const float *counts, int classcount, float total) {
+    return imp_entropy(counts, classcount, total);
+}
 
+float ds_gini_counts(const float *counts, int classcount, float total) {
+    return imp_gini(counts, classcount, total);
+}
@@ -10,6 +10,11 @@ typedef struct data_set {
     int has_ydata;
     float **x_data;
     float *y_data;
+    // per-row sample weights, NULL means every row has weight 1
+    float *weights;
+    // per-column flags set by ds_set_categorical, NULL means every column
+    // is numeric
+    unsigned char *categorical;
 } data_set;
 
 // colcount must be the same for all rows
@@ -26,19 +31,49 @@ void ds_free(data_set *ds);
 // y will be ignored if has_ydata is false
 void ds_add_item(data_set *ds, float *x, float y);
 
+// same as ds_add_item, for a row that stands for `weight` samples
+void ds_add_weighted_item(data_set *ds, float *x, float y, float weight);
+
+// the weight of a row
+#define ds_weight(ds, row) ((ds)->weights != NULL ? (ds)->weights[row] : 1.0f)
+
+// declare col categorical: its values are category codes (the integer part
+// of values from 0 up), which the trainers split into two sets of categories
+// instead of splitting at a threshold. returns -1 if col is out of range
+int ds_set_categorical(data_set *ds, unsigned int col);
+
+// whether col has been declared categorical
+#define ds_is_categorical(ds, col) ((ds)->categorical != NULL && (ds)->categorical[col])
+
+// collapse rows with bit-identical x and y values into one row, whose weight
+// is the sum of the weights of the rows it replaces. rows keep the order of
+// their first occurrence. rows with the same x but different y values stay
+// separate, so every distinct feature vector keeps one weighted row per class
+// returns the number of rows removed
+unsigned int ds_dedup(data_set *ds);
+
+// the total weight of all rows
+double ds_total_weight(data_set *ds);
+
 // compute the min/max/mean/variance of the specified column
+// the mean is weighted by the sample weights
 float ds_col_mean(data_set *ds, unsigned int col);
 float ds_col_variance(data_set *ds, unsigned int col);
 float ds_col_min(data_set *ds, unsigned int col);
 float ds_col_max(data_set *ds, unsigned int col);
 
-// compute the entropy in the data set
+// compute the entropy in the data set, using the sample weights
 float ds_entropy(data_set *ds);
 
 // population diversity (Gini Index)
 // sum of squares of proportions of classes
 float ds_gini(data_set *ds);
 
+// the same two metrics computed from a histogram of class counts
+// counts has classcount entries that add up to total
+float ds_entropy_counts(const float *counts, int classcount, float total);
+float ds_gini_counts(const float *counts, int classcount, float total);
+
 // return an array of all of the classes in y_data, and sets count to the
 // number of classes
 // WARNING: this breaks if there are more than 1024 classes, but I'm too lazy
@@ -1,28 +1,184 @@
+#define _POSIX_C_SOURCE 200809L
+// MAP_ANONYMOUS
+#define _DEFAULT_SOURCE
+
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
+#include <stdint.h>
 #include <time.h>
 #include <string.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
 #include "decision_tree.h"
+#include "impurity.h"
 
 dt_node* dt_new_node();
 void dt_free_node(dt_node *node);
-int dt_split_on_node(dt_node *node, data_set *train_data, int depth, split_criterion criterion);
 float dt_classify(decision_tree *dt, data_set *data, int row);
+float dt_predict_from(const dt_node *node, const float *x, ptrdiff_t col_stride);
 int count_nodes(dt_node *node);
 float guess_node_class(decision_tree *dt, dt_node *node);
+int prune_node(decision_tree *dt, dt_node *node, data_set *validation_data,
+        unsigned int *rows, unsigned int rowcount);
+int dt_categorical(unsigned int *catcounts, int col);
+unsigned int dt_category_code(float value, unsigned int catcount);
+int dt_compare_category_keys(const void *a, const void *b);
+
+// a category and the share of the node's majority class among its rows
+typedef struct dt_category_key {
+    float share;
+    unsigned int code;
+} dt_category_key;
+
+// private state shared by the recursive training functions
+typedef struct dt_build {
+    data_set *data;
+    split_criterion criterion;
+    int max_depth;
+    // y values of the training rows are encoded as indices into classes
+    int classcount;
+    float *classes;
+    int *labels;
+    // partition buffer, as long as the training row list
+    unsigned int *scratch;
+    // class histograms for the two sides of a candidate split
+    float *lesser;
+    float *greater;
+    // approximate split search, see decision_tree.sample_rate
+    float sample_rate;
+    unsigned int sample_min_rows;
+    float sample_tolerance;
+    uint32_t rng;
+    // sampled rows (as long as the training row list), the per-class sampling
+    // position, and the sampled split score of every column
+    unsigned int *sample;
+    float *sample_next;
+    float *gains;
+    // categorical columns, see dt_prepared.catcounts. cathist holds a class
+    // histogram per category of one column, catkeys orders the categories,
+    // and set and best_set are the bitsets of the last scored split and of
+    // the best one so far
+    unsigned int *catcounts;
+    float *cathist;
+    dt_category_key *catkeys;
+    uint32_t *set;
+    uint32_t *best_set;
+} dt_build;
+
+int dt_build_node(dt_build *b, dt_node *node, unsigned int *rows, unsigned int rowcount, int depth);
+float dt_category_split(dt_build *b, float parent_impurity, const float *hist,
+        unsigned int catcount, uint32_t *set);
+void dt_build_alloc_categories(dt_build *b, int colcount);
+void dt_keep_split(dt_build *b, int col);
+int dt_level_settle(dt_node *node, const float *counts, const float *classes,
+        int classcount, int max_depth, int depth);
+int dt_level_pick(dt_build *b, int colcount, const float *counts, const float *means,
+        const float *sidecounts, const float *cathists, const long *catoffset,
+        int *col, float *value);
+dt_node** dt_level_grow(dt_node **open, int opencount, const int *splitting,
+        const int *cols, const float *values, uint32_t **sets, const unsigned int *catcounts,
+        int *child_of, int *nextcount, int *leaves);
+
+// the most floats of split statistics dt_train_levelwise keeps at once,
+// levels with more open nodes than fit are handled in several passes
+#define DT_LEVEL_STATS_LIMIT (1 << 24)
+
+// private state of dt_train_distributed. it is set up before the workers are
+// forked, and everything it points to after pids lives in one shared
+// mapping: the statistics of the open nodes in the current group (see
+// dt_train_levelwise), then the splits the coordinator picked for them
+typedef struct dt_dist {
+    dt_prepared *prep;
+    int workers;
+    int groupsize;
+    long *catoffset;
+    long catstride;
+    // the words of the largest category bitset
+    unsigned int setwords;
+    // whether the class histograms add up to the same floats in any order,
+    // see dt_train_distributed
+    int exact;
+    // the coordinator process and the worker processes
+    pid_t coordinator;
+    pid_t *pids;
+    // all waits for the workers and the coordinator, phase only for the
+    // workers, between the steps of a statistics pass
+    struct dt_dist_barrier *all;
+    struct dt_dist_barrier *phase;
+    // the number of open nodes on the current level, -1 once the tree is done
+    int *opencount;
+    float *counts;
+    double *sums;
+    double *weights;
+    int *splitting;
+    float *means;
+    float *sidecounts;
+    float *cathists;
+    int *cols;
+    float *values;
+    uint32_t *sets;
+    // the number of rows worker w has at node k of the group, at
+    // noderows[w * groupsize + k]
+    unsigned int *noderows;
+    // the side counts and category histograms of every worker's shard when
+    // exact, groupsize nodes of colcount * 2 * classcount + catstride floats
+    // per worker
+    float *partial;
+} dt_dist;
+
+// a barrier between processes, whose waits wake up every DT_DIST_POLL_MS to
+// check that the processes on the other side are still alive
+typedef struct dt_dist_barrier {
+    pthread_mutex_t lock;
+    pthread_cond_t done;
+    int count;
+    int arrived;
+    unsigned int round;
+} dt_dist_barrier;
+
+#define DT_DIST_POLL_MS 100
+// the blocks per worker that a statistics pass is cut into, see dt_dist_ordered
+#define DT_DIST_BLOCKS 8
+
+// nodes n0 up to n1 and columns c0 up to c1 of a group's statistics
+typedef struct dt_dist_block {
+    long n0;
+    long n1;
+    int c0;
+    int c1;
+} dt_dist_block;
+
+void dt_dist_worker(dt_dist *d, int w);
+int dt_dist_wait(dt_dist *d, dt_dist_barrier *barrier);
+void dt_dist_sync(dt_dist *d, dt_dist_barrier *barrier);
+int dt_dist_alive(dt_dist *d);
+void dt_dist_barrier_init(dt_dist_barrier *barrier, int count);
+long dt_dist_blocks(dt_dist *d, const long *work, long gn, dt_dist_block *blocks);
+void dt_dist_ordered(dt_dist *d, int w, unsigned int *rows, unsigned int *start,
+        int g0, long gn, int pass, const dt_dist_block *blocks, long blockcount);
+void dt_dist_local(dt_dist *d, int w, unsigned int *rows, unsigned int *start, int g0, long gn);
+void dt_dist_add_row(dt_dist *d, const float *x, int label, float weight, const float *means,
+        float *sidecounts, float *cathists, int c0, int c1);
 
 decision_tree* dt_new(unsigned int seed, split_criterion criterion) {
-    if(seed > 0) {
-        srand(seed);
-    }
-    else {
-        srand(time(NULL));
+    if(seed == 0) {
+        seed = time(NULL);
     }
+    srand(seed);
 
     decision_tree *dt = malloc(sizeof(decision_tree));
     dt->root = dt_new_node();
     dt->criterion = criterion;
+    dt->max_depth = 0;
+    dt->seed = seed;
+    dt->sample_rate = 0;
+    dt->sample_min_rows = DT_SAMPLE_MIN_ROWS;
+    dt->sample_tolerance = DT_SAMPLE_TOLERANCE;
     return dt;
 }
 
@@ -31,21 +187,1208 @@ void dt_free(decision_tree *dt) {
     free(dt);
 }
 
-int dt_node_count(decision_tree *dt) {
-    return count_nodes(dt->root);
+int dt_node_count(decision_tree *dt) {
+    return count_nodes(dt->root);
+}
+
+int dt_train(decision_tree *dt, data_set *train_data) {
+    return dt_train_rows(dt, train_data, NULL, train_data->rowcount);
+}
+
+int dt_train_rows(decision_tree *dt, data_set *train_data, unsigned int *rows, unsigned int rowcount) {
+    if(train_data->has_ydata == 0) {
+        fprintf(stderr, "Data set must have y data!\n");
+        return -1;
+    }
+
+    dt_prepared *prep = dt_prepare(train_data, rows, rowcount);
+    int result = dt_train_prepared(dt, prep);
+    dt_prepared_free(prep);
+    return result;
+}
+
+dt_prepared* dt_prepare(data_set *train_data, unsigned int *rows, unsigned int rowcount) {
+    if(train_data->has_ydata == 0) {
+        fprintf(stderr, "Data set must have y data!\n");
+        return NULL;
+    }
+
+    dt_prepared *prep = malloc(sizeof(dt_prepared));
+    prep->data = train_data;
+    prep->rowcount = rowcount;
+    prep->rows = malloc((rowcount + 1) * sizeof(unsigned int));
+    for(unsigned int i = 0; i < rowcount; i++) {
+        prep->rows[i] = rows != NULL ? rows[i] : i;
+    }
+
+    int classcap = 16;
+    prep->classcount = 0;
+    prep->classes = malloc(classcap * sizeof(float));
+    prep->labels = malloc((train_data->rowcount + 1) * sizeof(int));
+    for(unsigned int i = 0; i < rowcount; i++) {
+        float y = train_data->y_data[prep->rows[i]];
+        int c = 0;
+        while(c < prep->classcount && prep->classes[c] != y) {
+            c += 1;
+        }
+        if(c == prep->classcount) {
+            if(prep->classcount == classcap) {
+                classcap *= 2;
+                prep->classes = realloc(prep->classes, classcap * sizeof(float));
+            }
+            prep->classes[c] = y;
+            prep->classcount += 1;
+        }
+        prep->labels[prep->rows[i]] = c;
+    }
+
+    prep->catcounts = NULL;
+    if(train_data->categorical != NULL) {
+        prep->catcounts = calloc(train_data->colcount, sizeof(unsigned int));
+        for(unsigned int col = 0; col < train_data->colcount; col++) {
+            if(!ds_is_categorical(train_data, col)) {
+                continue;
+            }
+            unsigned int count = 1;
+            for(unsigned int i = 0; i < rowcount; i++) {
+                float value = train_data->x_data[prep->rows[i]][col];
+                if(value >= 0 && value < DT_MAX_CATEGORIES && (unsigned int)value >= count) {
+                    count = (unsigned int)value + 1;
+                }
+            }
+            prep->catcounts[col] = count;
+        }
+    }
+
+    return prep;
+}
+
+void dt_prepared_free(dt_prepared *prep) {
+    if(prep == NULL) {
+        return;
+    }
+    free(prep->rows);
+    free(prep->classes);
+    free(prep->labels);
+    free(prep->catcounts);
+    free(prep);
+}
+
+int dt_train_prepared(decision_tree *dt, dt_prepared *prep) {
+    if(prep == NULL) {
+        return -1;
+    }
+    if(prep->rowcount < 1) {
+        fprintf(stderr, "No rows in training set!\n");
+        return -1;
+    }
+
+    // this comes in handy occasionally
+    dt->dataset = prep->data;
+
+    // the builder partitions its row list in place, so work on a copy
+    unsigned int *order = malloc(prep->rowcount * sizeof(unsigned int));
+    memcpy(order, prep->rows, prep->rowcount * sizeof(unsigned int));
+
+    dt_build b;
+    b.data = prep->data;
+    b.criterion = dt->criterion;
+    b.max_depth = dt->max_depth;
+    b.classcount = prep->classcount;
+    b.classes = prep->classes;
+    b.labels = prep->labels;
+    b.scratch = malloc(prep->rowcount * sizeof(unsigned int));
+    b.lesser = malloc(b.classcount * sizeof(float));
+    b.greater = malloc(b.classcount * sizeof(float));
+    b.sample_rate = dt->sample_rate;
+    b.sample_min_rows = dt->sample_min_rows;
+    b.sample_tolerance = dt->sample_tolerance;
+    b.rng = dt->seed != 0 ? dt->seed : 1;
+    b.sample = NULL;
+    b.sample_next = NULL;
+    b.gains = NULL;
+    if(b.sample_rate > 0 && b.sample_rate < 1 && prep->rowcount >= b.sample_min_rows) {
+        b.sample = malloc(prep->rowcount * sizeof(unsigned int));
+        b.sample_next = malloc(b.classcount * sizeof(float));
+        b.gains = malloc(prep->data->colcount * sizeof(float));
+    }
+    b.catcounts = prep->catcounts;
+    dt_build_alloc_categories(&b, prep->data->colcount);
+
+    int count = dt_build_node(&b, dt->root, order, prep->rowcount, 0);
+    printf("Decision tree has %d nodes\n", count);
+
+    free(b.scratch);
+    free(b.lesser);
+    free(b.greater);
+    free(b.sample);
+    free(b.sample_next);
+    free(b.gains);
+    free(b.cathist);
+    free(b.catkeys);
+    free(b.set);
+    free(b.best_set);
+    free(order);
+    return 0;
+}
+
+int dt_train_levelwise(decision_tree *dt, data_set *train_data) {
+    dt_prepared *prep = dt_prepare(train_data, NULL, train_data->rowcount);
+    if(prep == NULL) {
+        return -1;
+    }
+    if(prep->rowcount < 1) {
+        fprintf(stderr, "No rows in training set!\n");
+        dt_prepared_free(prep);
+        return -1;
+    }
+
+    // this comes in handy occasionally
+    dt->dataset = train_data;
+
+    data_set *data = train_data;
+    unsigned int rowcount = prep->rowcount;
+    int colcount = data->colcount;
+    int classcount = prep->classcount;
+    int *labels = prep->labels;
+    unsigned int *catcounts = prep->catcounts;
+
+    // every row is tagged with the index of the open node it sits at on the
+    // current level, or -1 once it has reached a leaf
+    int *node_of = calloc(rowcount, sizeof(int));
+
+    int opencount = 1;
+    dt_node **open = malloc(sizeof(dt_node*));
+    open[0] = dt->root;
+
+    // the nodes of the previous level and the index of their first child in
+    // open, the rows are sent down their splits during the first pass over
+    // the next level
+    dt_node **parents = NULL;
+    int *child_of = NULL;
+
+    // categorical columns keep a class histogram per category instead of
+    // one per side of the mean, at catoffset[col] in a node's histograms
+    long *catoffset = malloc((colcount + 1) * sizeof(long));
+    long catstride = 0;
+    for(int col = 0; col < colcount; col++) {
+        catoffset[col] = catstride;
+        if(dt_categorical(catcounts, col)) {
+            catstride += (long)(catcounts[col] + 1) * classcount;
+        }
+    }
+
+    // scratch space for dt_category_split
+    dt_build b;
+    memset(&b, 0, sizeof(dt_build));
+    b.criterion = dt->criterion;
+    b.classcount = classcount;
+    b.lesser = malloc(classcount * sizeof(float));
+    b.greater = malloc(classcount * sizeof(float));
+    b.catcounts = catcounts;
+    dt_build_alloc_categories(&b, colcount);
+
+    // the number of open nodes handled per statistics pass
+    long per_node = (long)colcount * (2 * classcount + 3) + catstride + 1;
+    int groupsize = DT_LEVEL_STATS_LIMIT / per_node;
+    if(groupsize < 1) {
+        groupsize = 1;
+    }
+
+    int leaves = 0;
+    int depth = 0;
+
+    while(opencount > 0) {
+        int groupcount = groupsize < opencount ? groupsize : opencount;
+        float *counts = calloc((long)opencount * classcount, sizeof(float));
+        int *splitting = malloc(opencount * sizeof(int));
+        int *next_col = malloc(opencount * sizeof(int));
+        float *next_value = malloc(opencount * sizeof(float));
+        uint32_t **next_set = calloc(opencount, sizeof(uint32_t*));
+        double *sums = malloc(((long)groupcount * colcount + 1) * sizeof(double));
+        double *weights = malloc(groupcount * sizeof(double));
+        float *means = malloc(((long)groupcount * colcount + 1) * sizeof(float));
+        float *sidecounts = malloc(((long)groupcount * colcount * 2 * classcount + 1) * sizeof(float));
+        float *cathists = malloc(((long)groupcount * catstride + 1) * sizeof(float));
+
+        for(int g0 = 0; g0 < opencount; g0 += groupsize) {
+            int g1 = g0 + groupsize < opencount ? g0 + groupsize : opencount;
+            long gn = g1 - g0;
+
+            // pass 1: column sums of every open node in the group. the first
+            // group's pass also moves the rows down to this level and counts
+            // the classes of every open node
+            memset(sums, 0, gn * colcount * sizeof(double));
+            memset(weights, 0, gn * sizeof(double));
+            for(unsigned int i = 0; i < rowcount; i++) {
+                unsigned int row = prep->rows[i];
+                int o = node_of[i];
+                if(o < 0) {
+                    continue;
+                }
+                if(g0 == 0) {
+                    if(parents != NULL) {
+                        if(child_of[o] < 0) {
+                            node_of[i] = -1;
+                            continue;
+                        }
+                        dt_node *parent = parents[o];
+                        int side = dt_goes_left(parent, data->x_data[row][parent->split_col]) ? 0 : 1;
+                        o = child_of[o] + side;
+                        node_of[i] = o;
+                    }
+                    counts[o * classcount + labels[row]] += ds_weight(data, row);
+                }
+                if(o < g0 || o >= g1) {
+                    continue;
+                }
+
+                float *x = data->x_data[row];
+                double *node_sums = &sums[(o - g0) * colcount];
+                if(data->weights == NULL) {
+                    for(int col = 0; col < colcount; col++) {
+                        node_sums[col] += x[col];
+                    }
+                    weights[o - g0] += 1;
+                }
+                else {
+                    for(int col = 0; col < colcount; col++) {
+                        node_sums[col] += (double)x[col] * data->weights[row];
+                    }
+                    weights[o - g0] += data->weights[row];
+                }
+            }
+
+            // the class counts are complete now, so settle which nodes are
+            // leaves the same way dt_build_node does
+            if(g0 == 0) {
+                for(int o = 0; o < opencount; o++) {
+                    splitting[o] = dt_level_settle(open[o], &counts[o * classcount],
+                            prep->classes, classcount, dt->max_depth, depth);
+                }
+            }
+
+            for(int o = g0; o < g1; o++) {
+                for(int col = 0; col < colcount; col++) {
+                    long k = (o - g0) * colcount + col;
+                    means[k] = (float)(sums[k] / weights[o - g0]);
+                }
+            }
+
+            // pass 2: class counts on each side of every column's mean, and
+            // in every category of the categorical columns
+            memset(sidecounts, 0, gn * colcount * 2 * classcount * sizeof(float));
+            memset(cathists, 0, gn * catstride * sizeof(float));
+            for(unsigned int i = 0; i < rowcount; i++) {
+                int o = node_of[i];
+                if(o < g0 || o >= g1 || !splitting[o]) {
+                    continue;
+                }
+                unsigned int row = prep->rows[i];
+                float *x = data->x_data[row];
+                float weight = ds_weight(data, row);
+                long k = (o - g0) * colcount;
+                for(int col = 0; col < colcount; col++) {
+                    if(dt_categorical(catcounts, col)) {
+                        unsigned int code = dt_category_code(x[col], catcounts[col]);
+                        cathists[(o - g0) * catstride + catoffset[col] +
+                            code * classcount + labels[row]] += weight;
+                        continue;
+                    }
+                    int side = x[col] < means[k + col] ? 0 : 1;
+                    sidecounts[((k + col) * 2 + side) * classcount + labels[row]] += weight;
+                }
+            }
+
+            for(int o = g0; o < g1; o++) {
+                if(!splitting[o]) {
+                    continue;
+                }
+                splitting[o] = dt_level_pick(&b, colcount, &counts[o * classcount],
+                        &means[(o - g0) * colcount], &sidecounts[(o - g0) * colcount * 2 * classcount],
+                        &cathists[(o - g0) * catstride], catoffset, &next_col[o], &next_value[o]);
+                if(splitting[o] && dt_categorical(catcounts, next_col[o])) {
+                    size_t bytes = DT_CATEGORY_WORDS(catcounts[next_col[o]]) * sizeof(uint32_t);
+                    next_set[o] = malloc(bytes);
+                    memcpy(next_set[o], b.best_set, bytes);
+                }
+            }
+        }
+
+        // make the children of every node that split, and the leaves
+        free(child_of);
+        child_of = malloc(opencount * sizeof(int));
+        int nextcount;
+        dt_node **next = dt_level_grow(open, opencount, splitting, next_col, next_value,
+                next_set, catcounts, child_of, &nextcount, &leaves);
+
+        free(counts);
+        free(splitting);
+        free(next_col);
+        free(next_value);
+        free(next_set);
+        free(sums);
+        free(weights);
+        free(means);
+        free(sidecounts);
+        free(cathists);
+        free(parents);
+        parents = open;
+        open = next;
+        opencount = nextcount;
+        depth += 1;
+    }
+
+    free(open);
+    free(parents);
+    free(child_of);
+    free(node_of);
+    free(catoffset);
+    free(b.lesser);
+    free(b.greater);
+    free(b.cathist);
+    free(b.catkeys);
+    free(b.set);
+    free(b.best_set);
+    dt_prepared_free(prep);
+
+    printf("Decision tree has %d nodes\n", leaves);
+    return 0;
+}
+
+int dt_train_distributed(decision_tree *dt, data_set *train_data, int workers) {
+    dt_prepared *prep = dt_prepare(train_data, NULL, train_data->rowcount);
+    if(prep == NULL) {
+        return -1;
+    }
+    if(prep->rowcount < 1) {
+        fprintf(stderr, "No rows in training set!\n");
+        dt_prepared_free(prep);
+        return -1;
+    }
+    if(workers < 1) {
+        workers = sysconf(_SC_NPROCESSORS_ONLN);
+        if(workers < 1) {
+            workers = 1;
+        }
+    }
+
+    // this comes in handy occasionally
+    dt->dataset = train_data;
+
+    int colcount = train_data->colcount;
+    int classcount = prep->classcount;
+    unsigned int *catcounts = prep->catcounts;
+
+    dt_dist d;
+    d.prep = prep;
+    d.workers = workers;
+    d.catoffset = malloc((colcount + 1) * sizeof(long));
+    d.catstride = 0;
+    d.setwords = 0;
+    for(int col = 0; col < colcount; col++) {
+        d.catoffset[col] = d.catstride;
+        if(dt_categorical(catcounts, col)) {
+            d.catstride += (long)(catcounts[col] + 1) * classcount;
+            if(DT_CATEGORY_WORDS(catcounts[col]) > d.setwords) {
+                d.setwords = DT_CATEGORY_WORDS(catcounts[col]);
+            }
+        }
+    }
+
+    // unweighted rows and whole weights add up to whole numbers, which floats
+    // hold exactly up to 2^24. the side counts and category histograms then
+    // come out the same in any order, so every worker counts its own shard
+    // and the shards are merged. otherwise they are added up in training row
+    // order like the column sums
+    double total = 0;
+    d.exact = 1;
+    for(unsigned int i = 0; i < prep->rowcount; i++) {
+        float weight = ds_weight(train_data, prep->rows[i]);
+        d.exact = d.exact && weight == floorf(weight);
+        total += weight;
+    }
+    d.exact = d.exact && total <= (1 << 24);
+
+    // a level never has more open nodes than there are rows
+    long stats = (long)colcount * 2 * classcount + d.catstride;
+    long per_node = (long)colcount * (2 * classcount + 5) + classcount + d.catstride + d.setwords + 8 +
+        workers + (d.exact ? workers * stats : 0);
+    long groupsize = DT_LEVEL_STATS_LIMIT / per_node;
+    if(groupsize > prep->rowcount) {
+        groupsize = prep->rowcount;
+    }
+    if(groupsize < 1) {
+        groupsize = 1;
+    }
+    d.groupsize = groupsize;
+
+    // lay the shared arrays out one after another, the doubles first
+    size_t bytes = 2 * sizeof(dt_dist_barrier) + sizeof(double);
+    bytes += groupsize * (colcount + 1) * sizeof(double);
+    bytes += groupsize * (classcount + colcount + colcount * 2 * classcount + d.catstride) * sizeof(float);
+    bytes += groupsize * (2 * sizeof(int) + sizeof(float) + d.setwords * sizeof(uint32_t));
+    bytes += groupsize * workers * sizeof(unsigned int);
+    bytes += d.exact ? groupsize * workers * stats * sizeof(float) : 0;
+    char *shared = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if(shared == MAP_FAILED) {
+        fprintf(stderr, "Unable to map %zu bytes of shared memory\n", bytes);
+        free(d.catoffset);
+        dt_prepared_free(prep);
+        return -1;
+    }
+    d.all = (dt_dist_barrier*)shared;
+    d.phase = d.all + 1;
+    d.sums = (double*)(d.phase + 1);
+    d.weights = d.sums + groupsize * colcount;
+    d.opencount = (int*)(d.weights + groupsize);
+    d.splitting = d.opencount + 1;
+    d.cols = d.splitting + groupsize;
+    d.counts = (float*)(d.cols + groupsize);
+    d.means = d.counts + groupsize * classcount;
+    d.sidecounts = d.means + groupsize * colcount;
+    d.cathists = d.sidecounts + groupsize * colcount * 2 * classcount;
+    d.values = d.cathists + groupsize * d.catstride;
+    d.sets = (uint32_t*)(d.values + groupsize);
+    d.noderows = d.sets + groupsize * d.setwords;
+    d.partial = (float*)(d.noderows + groupsize * workers);
+
+    dt_dist_barrier_init(d.all, workers + 1);
+    dt_dist_barrier_init(d.phase, workers);
+
+    // the workers inherit the training data, don't let them inherit
+    // buffered output too
+    fflush(stdout);
+    fflush(stderr);
+    d.coordinator = getpid();
+    d.pids = malloc(workers * sizeof(pid_t));
+    for(int w = 0; w < workers; w++) {
+        d.pids[w] = fork();
+        if(d.pids[w] == 0) {
+            dt_dist_worker(&d, w);
+            _exit(0);
+        }
+        if(d.pids[w] < 0) {
+            fprintf(stderr, "Unable to start worker process %d\n", w);
+            for(int i = 0; i < w; i++) {
+                kill(d.pids[i], SIGKILL);
+                waitpid(d.pids[i], NULL, 0);
+            }
+            free(d.pids);
+            munmap(shared, bytes);
+            free(d.catoffset);
+            dt_prepared_free(prep);
+            return -1;
+        }
+    }
+
+    // scratch space for dt_category_split
+    dt_build b;
+    memset(&b, 0, sizeof(dt_build));
+    b.criterion = dt->criterion;
+    b.classcount = classcount;
+    b.lesser = malloc(classcount * sizeof(float));
+    b.greater = malloc(classcount * sizeof(float));
+    b.catcounts = catcounts;
+    dt_build_alloc_categories(&b, colcount);
+
+    int opencount = 1;
+    dt_node **open = malloc(sizeof(dt_node*));
+    open[0] = dt->root;
+    int leaves = 0;
+    int depth = 0;
+    int failed = 0;
+
+    // the coordinator: the workers fill in the statistics of every group of
+    // open nodes, and the coordinator settles the nodes and picks their
+    // splits from them, the same way dt_train_levelwise does. every wait
+    // fails if a worker has died, which ends the training
+    while(1) {
+        *d.opencount = opencount > 0 ? opencount : -1;
+        if(dt_dist_wait(&d, d.all) != 0) {
+            failed = 1;
+            break;
+        }
+        if(opencount == 0) {
+            break;
+        }
+
+        int *splitting = malloc(opencount * sizeof(int));
+        int *next_col = malloc(opencount * sizeof(int));
+        float *next_value = malloc(opencount * sizeof(float));
+        uint32_t **next_set = calloc(opencount, sizeof(uint32_t*));
+
+        for(int g0 = 0; g0 < opencount && !failed; g0 += groupsize) {
+            int g1 = g0 + groupsize < opencount ? g0 + groupsize : opencount;
+
+            // pass 1 gave the class counts and column sums
+            if(dt_dist_wait(&d, d.all) != 0) {
+                failed = 1;
+                break;
+            }
+            for(int o = g0; o < g1; o++) {
+                long k = (long)(o - g0) * colcount;
+                d.splitting[o - g0] = dt_level_settle(open[o], &d.counts[(o - g0) * classcount],
+                        prep->classes, classcount, dt->max_depth, depth);
+                for(int col = 0; col < colcount; col++) {
+                    d.means[k + col] = (float)(d.sums[k + col] / d.weights[o - g0]);
+                }
+            }
+            if(dt_dist_wait(&d, d.all) != 0) {
+                failed = 1;
+                break;
+            }
+
+            // pass 2 gave the side counts and category histograms
+            if(dt_dist_wait(&d, d.all) != 0) {
+                failed = 1;
+                break;
+            }
+            for(int o = g0; o < g1; o++) {
+                long k = o - g0;
+                if(d.splitting[k]) {
+                    d.splitting[k] = dt_level_pick(&b, colcount, &d.counts[k * classcount],
+                            &d.means[k * colcount], &d.sidecounts[k * colcount * 2 * classcount],
+                            &d.cathists[k * d.catstride], d.catoffset, &d.cols[k], &d.values[k]);
+                }
+                splitting[o] = d.splitting[k];
+                next_col[o] = d.cols[k];
+                next_value[o] = d.values[k];
+                if(splitting[o] && dt_categorical(catcounts, next_col[o])) {
+                    size_t setbytes = DT_CATEGORY_WORDS(catcounts[next_col[o]]) * sizeof(uint32_t);
+                    next_set[o] = malloc(setbytes);
+                    memcpy(next_set[o], b.best_set, setbytes);
+                    memcpy(&d.sets[k * d.setwords], b.best_set, setbytes);
+                }
+            }
+            if(dt_dist_wait(&d, d.all) != 0) {
+                failed = 1;
+                break;
+            }
+        }
+
+        if(failed) {
+            // leave a tree that can still be used: the open nodes become
+            // leaves, with whatever prediction they were settled with
+            for(int o = 0; o < opencount; o++) {
+                open[o]->is_leaf = 1;
+                free(next_set[o]);
+            }
+            free(splitting);
+            free(next_col);
+            free(next_value);
+            free(next_set);
+            break;
+        }
+
+        int *child_of = malloc(opencount * sizeof(int));
+        int nextcount;
+        dt_node **next = dt_level_grow(open, opencount, splitting, next_col, next_value,
+                next_set, catcounts, child_of, &nextcount, &leaves);
+
+        free(splitting);
+        free(next_col);
+        free(next_value);
+        free(next_set);
+        free(child_of);
+        free(open);
+        open = next;
+        opencount = nextcount;
+        depth += 1;
+    }
+
+    if(failed) {
+        fprintf(stderr, "A worker process died, stopping the training\n");
+        for(int w = 0; w < workers; w++) {
+            if(d.pids[w] > 0) {
+                kill(d.pids[w], SIGKILL);
+            }
+        }
+    }
+    for(int w = 0; w < workers; w++) {
+        int status;
+        if(d.pids[w] > 0 && (waitpid(d.pids[w], &status, 0) < 0 ||
+                    !WIFEXITED(status) || WEXITSTATUS(status) != 0) && !failed) {
+            fprintf(stderr, "Worker process %d failed\n", w);
+            failed = 1;
+        }
+    }
+
+    free(d.pids);
+    free(open);
+    free(b.lesser);
+    free(b.greater);
+    free(b.cathist);
+    free(b.catkeys);
+    free(b.set);
+    free(b.best_set);
+    munmap(shared, bytes);
+    free(d.catoffset);
+    dt_prepared_free(prep);
+
+    if(failed) {
+        return -1;
+    }
+    printf("Decision tree has %d nodes\n", leaves);
+    return 0;
+}
+
+// private function, settles an open node of a level-wise builder from the
+// class histogram of its rows the same way dt_build_node does: sets its
+// prediction and training error, and returns whether it should be split
+int dt_level_settle(dt_node *node, const float *counts, const float *classes,
+        int classcount, int max_depth, int depth) {
+    int present = 0;
+    int majority = 0;
+    float total = 0;
+    for(int c = 0; c < classcount; c++) {
+        if(counts[c] > 0) {
+            present += 1;
+        }
+        if(counts[c] > counts[majority]) {
+            majority = c;
+        }
+        total += counts[c];
+    }
+    node->prediction_value = classes[majority];
+    node->train_error = total - counts[majority];
+    return present > 1 && !(max_depth > 0 && depth >= max_depth);
+}
+
+// private function, picks the split of an open node of a level-wise builder
+// from its statistics: the class histogram of its rows, the column means, two
+// class histograms per column for the rows on each side of the mean, and the
+// category histograms of the categorical columns at catoffset[col] in
+// cathists. stores the column and the split value (the categories of a
+// categorical split go to b->best_set), returns 0 if the split leaves one
+// side empty
+int dt_level_pick(dt_build *b, int colcount, const float *counts, const float *means,
+        const float *sidecounts, const float *cathists, const long *catoffset,
+        int *col, float *value) {
+    int classcount = b->classcount;
+    unsigned int *catcounts = b->catcounts;
+    float parent = 0;
+    if(b->criterion == CR_ENTROPY) {
+        float total = 0;
+        for(int c = 0; c < classcount; c++) {
+            total += counts[c];
+        }
+        parent = ds_entropy_counts(counts, classcount, total);
+    }
+
+    float best = 0;
+    int bestcol = 0;
+    for(int j = 0; j < colcount; j++) {
+        float gain;
+        if(dt_categorical(catcounts, j)) {
+            gain = dt_category_split(b, parent, &cathists[catoffset[j]], catcounts[j], b->set);
+        }
+        else {
+            gain = dt_split_gain(b->criterion, parent, &sidecounts[(j * 2) * classcount],
+                    &sidecounts[(j * 2 + 1) * classcount], classcount);
+        }
+        if(j == 0 || gain > best) {
+            best = gain;
+            bestcol = j;
+            dt_keep_split(b, j);
+        }
+    }
+
+    float lesser_total = 0;
+    float greater_total = 0;
+    if(dt_categorical(catcounts, bestcol)) {
+        unsigned int catcount = catcounts[bestcol];
+        const float *hist = &cathists[catoffset[bestcol]];
+        for(unsigned int code = 0; code <= catcount; code++) {
+            float weight = 0;
+            for(int c = 0; c < classcount; c++) {
+                weight += hist[code * classcount + c];
+            }
+            if(DT_IN_CATEGORIES(b->best_set, catcount, code)) {
+                lesser_total += weight;
+            }
+            else {
+                greater_total += weight;
+            }
+        }
+    }
+    else {
+        for(int c = 0; c < classcount; c++) {
+            lesser_total += sidecounts[(bestcol * 2) * classcount + c];
+            greater_total += sidecounts[(bestcol * 2 + 1) * classcount + c];
+        }
+    }
+    *col = bestcol;
+    *value = dt_categorical(catcounts, bestcol) ? 0 : means[bestcol];
+    // the mean doesn't separate these rows, so no split can
+    return lesser_total != 0 && greater_total != 0;
+}
+
+// private function, makes the open nodes of a level-wise builder that don't
+// split into leaves (adding them to leaves), and gives the others their
+// split and two children. the sets of categorical splits move into the nodes.
+// child_of[o] is set to the index of the first child of open[o] in the
+// returned next level, or -1 for leaves
+dt_node** dt_level_grow(dt_node **open, int opencount, const int *splitting,
+        const int *cols, const float *values, uint32_t **sets, const unsigned int *catcounts,
+        int *child_of, int *nextcount, int *leaves) {
+    int count = 0;
+    for(int o = 0; o < opencount; o++) {
+        dt_node *node = open[o];
+        if(!splitting[o]) {
+            node->is_leaf = 1;
+            child_of[o] = -1;
+            *leaves += 1;
+            free(sets[o]);
+            continue;
+        }
+
+        node->split_col = cols[o];
+        node->split_value = values[o];
+        if(sets[o] != NULL) {
+            node->categories = sets[o];
+            node->category_count = catcounts[cols[o]];
+        }
+        node->left = dt_new_node();
+        node->left->is_lesser = 1;
+        node->left->parent = node;
+        node->right = dt_new_node();
+        node->right->is_lesser = 0;
+        node->right->parent = node;
+        child_of[o] = count;
+        count += 2;
+    }
+
+    dt_node **next = malloc((count + 1) * sizeof(dt_node*));
+    for(int o = 0; o < opencount; o++) {
+        if(child_of[o] >= 0) {
+            next[child_of[o]] = open[o]->left;
+            next[child_of[o] + 1] = open[o]->right;
+        }
+    }
+    *nextcount = count;
+    return next;
+}
+
+// private function, the worker process w of dt_train_distributed. it owns the
+// w-th of d->workers contiguous shards of the training rows, keeps them
+// sorted by the open node they sit at, and adds them to the statistics of
+// each group of open nodes
+void dt_dist_worker(dt_dist *d, int w) {
+    dt_prepared *prep = d->prep;
+    data_set *data = prep->data;
+    unsigned int lo = (long)prep->rowcount * w / d->workers;
+    unsigned int hi = (long)prep->rowcount * (w + 1) / d->workers;
+
+    unsigned int *rows = malloc((hi - lo + 1) * sizeof(unsigned int));
+    unsigned int *next_rows = malloc((hi - lo + 1) * sizeof(unsigned int));
+    memcpy(rows, prep->rows + lo, (hi - lo) * sizeof(unsigned int));
+    // the rows at open node o are rows[start[o]] up to rows[start[o + 1]]
+    unsigned int *start = malloc(2 * sizeof(unsigned int));
+    start[0] = 0;
+    start[1] = hi - lo;
+
+    // the rows of every node of a group over all of the shards, and the
+    // blocks of the ordered passes
+    long *work = malloc((d->groupsize + 1) * sizeof(long));
+    dt_dist_block *blocks = malloc((d->groupsize + 2L * DT_DIST_BLOCKS * d->workers + 1) *
+            sizeof(dt_dist_block));
+
+    // the splits of the previous level, as broadcast by the coordinator
+    int prevcount = 0;
+    int *splitting = NULL;
+    int *cols = NULL;
+    float *values = NULL;
+    uint32_t *sets = NULL;
+
+    while(1) {
+        dt_dist_sync(d, d->all);
+        int opencount = *d->opencount;
+        if(opencount < 0) {
+            break;
+        }
+
+        // send the rows down the previous level's splits, each node's rows
+        // going to its left child then its right child. that keeps them in
+        // training order within every node, so the statistics add up in the
+        // same order as in dt_train. rows at new leaves are dropped
+        if(prevcount > 0) {
+            unsigned int *next_start = malloc((opencount + 1) * sizeof(unsigned int));
+            unsigned int count = 0;
+            int child = 0;
+            for(int p = 0; p < prevcount; p++) {
+                if(!splitting[p]) {
+                    continue;
+                }
+                for(int side = 0; side < 2; side++) {
+                    next_start[child + side] = count;
+                    for(unsigned int i = start[p]; i < start[p + 1]; i++) {
+                        float value = data->x_data[rows[i]][cols[p]];
+                        int left = sets != NULL && dt_categorical(prep->catcounts, cols[p]) ?
+                            DT_IN_CATEGORIES(&sets[(long)p * d->setwords], prep->catcounts[cols[p]], value) :
+                            value < values[p];
+                        if(left == !side) {
+                            next_rows[count++] = rows[i];
+                        }
+                    }
+                }
+                child += 2;
+            }
+            next_start[opencount] = count;
+
+            unsigned int *t = rows;
+            rows = next_rows;
+            next_rows = t;
+            free(start);
+            start = next_start;
+        }
+
+        free(splitting);
+        free(cols);
+        free(values);
+        free(sets);
+        splitting = malloc(opencount * sizeof(int));
+        cols = malloc(opencount * sizeof(int));
+        values = malloc(opencount * sizeof(float));
+        sets = d->setwords > 0 ? malloc((long)opencount * d->setwords * sizeof(uint32_t)) : NULL;
+
+        for(int g0 = 0; g0 < opencount; g0 += d->groupsize) {
+            int g1 = g0 + d->groupsize < opencount ? g0 + d->groupsize : opencount;
+            long gn = g1 - g0;
+
+            // every worker needs the rows of all the shards to cut the same
+            // blocks
+            for(long k = 0; k < gn; k++) {
+                d->noderows[w * d->groupsize + k] = start[g0 + k + 1] - start[g0 + k];
+            }
+            dt_dist_sync(d, d->phase);
+            for(long k = 0; k < gn; k++) {
+                work[k] = 0;
+                for(int v = 0; v < d->workers; v++) {
+                    work[k] += d->noderows[v * d->groupsize + k];
+                }
+            }
+
+            long blockcount = dt_dist_blocks(d, work, gn, blocks);
+            dt_dist_ordered(d, w, rows, start, g0, gn, 1, blocks, blockcount);
+            // the coordinator settles the nodes and works out the means
+            dt_dist_sync(d, d->all);
+            dt_dist_sync(d, d->all);
+            if(d->exact) {
+                dt_dist_local(d, w, rows, start, g0, gn);
+            }
+            else {
+                for(long k = 0; k < gn; k++) {
+                    work[k] = d->splitting[k] ? work[k] : 0;
+                }
+                blockcount = dt_dist_blocks(d, work, gn, blocks);
+                dt_dist_ordered(d, w, rows, start, g0, gn, 2, blocks, blockcount);
+            }
+            // the coordinator picks the splits
+            dt_dist_sync(d, d->all);
+            dt_dist_sync(d, d->all);
+
+            memcpy(&splitting[g0], d->splitting, gn * sizeof(int));
+            memcpy(&cols[g0], d->cols, gn * sizeof(int));
+            memcpy(&values[g0], d->values, gn * sizeof(float));
+            if(sets != NULL) {
+                memcpy(&sets[(long)g0 * d->setwords], d->sets, gn * d->setwords * sizeof(uint32_t));
+            }
+        }
+        prevcount = opencount;
+    }
+
+    free(rows);
+    free(next_rows);
+    free(start);
+    free(work);
+    free(blocks);
+    free(splitting);
+    free(cols);
+    free(values);
+    free(sets);
+}
+
+// private function, cuts the gn open nodes of a group into blocks for
+// dt_dist_ordered, about DT_DIST_BLOCKS per worker with similar numbers of
+// rows (work[k] at node k). runs of small nodes share a block, and nodes with
+// more rows than a block are cut into blocks of columns. returns the number
+// of blocks, which is at most gn + 2 * DT_DIST_BLOCKS * workers
+long dt_dist_blocks(dt_dist *d, const long *work, long gn, dt_dist_block *blocks) {
+    int colcount = d->prep->data->colcount;
+    long total = 0;
+    for(long k = 0; k < gn; k++) {
+        total += work[k];
+    }
+    long target = total / (DT_DIST_BLOCKS * d->workers) + 1;
+
+    long count = 0;
+    long n0 = 0;
+    long run = 0;
+    for(long k = 0; k < gn; k++) {
+        if(work[k] <= target) {
+            run += work[k];
+            if(run >= target) {
+                blocks[count++] = (dt_dist_block){n0, k + 1, 0, colcount};
+                n0 = k + 1;
+                run = 0;
+            }
+            continue;
+        }
+        if(n0 < k) {
+            blocks[count++] = (dt_dist_block){n0, k, 0, colcount};
+        }
+        long parts = (work[k] + target - 1) / target;
+        parts = parts < colcount ? parts : colcount;
+        parts = parts > 1 ? parts : 1;
+        for(long p = 0; p < parts; p++) {
+            blocks[count++] = (dt_dist_block){k, k + 1, colcount * p / parts, colcount * (p + 1) / parts};
+        }
+        n0 = k + 1;
+        run = 0;
+    }
+    if(n0 < gn) {
+        blocks[count++] = (dt_dist_block){n0, gn, 0, colcount};
+    }
+    return count;
+}
+
+// private function, worker w's part of an ordered statistics pass over the
+// gn open nodes of the group starting at g0: the class counts and column
+// sums for pass 1, the side counts and category histograms of the splitting
+// nodes for pass 2. the workers take the blocks in a wavefront: worker w adds
+// its rows to block j in step w + j, right after worker w - 1 did, so every
+// statistic is added up in training row order without any merging
+void dt_dist_ordered(dt_dist *d, int w, unsigned int *rows, unsigned int *start,
+        int g0, long gn, int pass, const dt_dist_block *blocks, long blockcount) {
+    dt_prepared *prep = d->prep;
+    data_set *data = prep->data;
+    int colcount = data->colcount;
+    int classcount = prep->classcount;
+    unsigned int *catcounts = prep->catcounts;
+    int *labels = prep->labels;
+    long sidestride = (long)colcount * 2 * classcount;
+
+    for(long step = 0; step < blockcount + d->workers - 1; step++) {
+        long j = step - w;
+        if(j < 0 || j >= blockcount) {
+            dt_dist_sync(d, d->phase);
+            continue;
+        }
+        int c0 = blocks[j].c0;
+        int c1 = blocks[j].c1;
+
+        for(long k = blocks[j].n0; k < blocks[j].n1; k++) {
+            if(pass == 1) {
+                float *node_counts = &d->counts[k * classcount];
+                double *node_sums = &d->sums[k * colcount];
+                // the first worker to reach a block starts its statistics,
+                // the class counts and weights go with the first columns
+                if(w == 0) {
+                    memset(node_sums + c0, 0, (c1 - c0) * sizeof(double));
+                    if(c0 == 0) {
+                        memset(node_counts, 0, classcount * sizeof(float));
+                        d->weights[k] = 0;
+                    }
+                }
+                for(unsigned int i = start[g0 + k]; i < start[g0 + k + 1]; i++) {
+                    unsigned int row = rows[i];
+                    float *x = data->x_data[row];
+                    if(c0 == 0) {
+                        node_counts[labels[row]] += ds_weight(data, row);
+                        d->weights[k] += data->weights == NULL ? 1 : data->weights[row];
+                    }
+                    if(data->weights == NULL) {
+                        for(int col = c0; col < c1; col++) {
+                            node_sums[col] += x[col];
+                        }
+                    }
+                    else {
+                        for(int col = c0; col < c1; col++) {
+                            node_sums[col] += (double)x[col] * data->weights[row];
+                        }
+                    }
+                }
+            }
+            else {
+                float *sidecounts = &d->sidecounts[k * sidestride];
+                float *cathists = &d->cathists[k * d->catstride];
+                if(w == 0) {
+                    memset(sidecounts + (long)c0 * 2 * classcount, 0,
+                            (long)(c1 - c0) * 2 * classcount * sizeof(float));
+                    for(int col = c0; col < c1; col++) {
+                        if(dt_categorical(catcounts, col)) {
+                            memset(cathists + d->catoffset[col], 0,
+                                    (long)(catcounts[col] + 1) * classcount * sizeof(float));
+                        }
+                    }
+                }
+                if(!d->splitting[k]) {
+                    continue;
+                }
+                for(unsigned int i = start[g0 + k]; i < start[g0 + k + 1]; i++) {
+                    unsigned int row = rows[i];
+                    dt_dist_add_row(d, data->x_data[row], labels[row], ds_weight(data, row),
+                            &d->means[k * colcount], sidecounts, cathists, c0, c1);
+                }
+            }
+        }
+        dt_dist_sync(d, d->phase);
+    }
+}
+
+// private function, worker w's part of pass 2 over the gn open nodes of the
+// group starting at g0 when the statistics are exact: every worker counts
+// its own rows into its partial statistics, with no waiting on the others,
+// then the workers merge them, each for a slice of the nodes. only the
+// shards with rows at a node take part in its merge
+void dt_dist_local(dt_dist *d, int w, unsigned int *rows, unsigned int *start, int g0, long gn) {
+    dt_prepared *prep = d->prep;
+    data_set *data = prep->data;
+    int colcount = data->colcount;
+    int *labels = prep->labels;
+    long sidestride = (long)colcount * 2 * prep->classcount;
+    long stats = sidestride + d->catstride;
+
+    float *mine = d->partial + (long)w * d->groupsize * stats;
+    for(long k = 0; k < gn; k++) {
+        if(!d->splitting[k] || start[g0 + k] == start[g0 + k + 1]) {
+            continue;
+        }
+        float *node = mine + k * stats;
+        memset(node, 0, stats * sizeof(float));
+        for(unsigned int i = start[g0 + k]; i < start[g0 + k + 1]; i++) {
+            unsigned int row = rows[i];
+            dt_dist_add_row(d, data->x_data[row], labels[row], ds_weight(data, row),
+                    &d->means[k * colcount], node, node + sidestride, 0, colcount);
+        }
+    }
+    dt_dist_sync(d, d->phase);
+
+    for(long k = gn * w / d->workers; k < gn * (w + 1) / d->workers; k++) {
+        if(!d->splitting[k]) {
+            continue;
+        }
+        float *sidecounts = &d->sidecounts[k * sidestride];
+        float *cathists = &d->cathists[k * d->catstride];
+        memset(sidecounts, 0, sidestride * sizeof(float));
+        memset(cathists, 0, d->catstride * sizeof(float));
+        for(int v = 0; v < d->workers; v++) {
+            if(d->noderows[v * d->groupsize + k] == 0) {
+                continue;
+            }
+            const float *node = d->partial + ((long)v * d->groupsize + k) * stats;
+            for(long s = 0; s < sidestride; s++) {
+                sidecounts[s] += node[s];
+            }
+            for(long s = 0; s < d->catstride; s++) {
+                cathists[s] += node[sidestride + s];
+            }
+        }
+    }
+}
+
+// private function, adds a row with the given label and weight to the side
+// counts and category histograms of one node, for columns c0 up to c1
+void dt_dist_add_row(dt_dist *d, const float *x, int label, float weight, const float *means,
+        float *sidecounts, float *cathists, int c0, int c1) {
+    unsigned int *catcounts = d->prep->catcounts;
+    int classcount = d->prep->classcount;
+    for(int col = c0; col < c1; col++) {
+        if(dt_categorical(catcounts, col)) {
+            unsigned int code = dt_category_code(x[col], catcounts[col]);
+            cathists[d->catoffset[col] + code * classcount + label] += weight;
+            continue;
+        }
+        int side = x[col] < means[col] ? 0 : 1;
+        sidecounts[(col * 2 + side) * classcount + label] += weight;
+    }
+}
+
+// private function, sets up a dt_dist_barrier for count processes, in
+// shared memory
+void dt_dist_barrier_init(dt_dist_barrier *barrier, int count) {
+    pthread_mutexattr_t lock_attr;
+    pthread_mutexattr_init(&lock_attr);
+    pthread_mutexattr_setpshared(&lock_attr, PTHREAD_PROCESS_SHARED);
+    // a process that dies holding the lock doesn't lock the others out
+    pthread_mutexattr_setrobust(&lock_attr, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(&barrier->lock, &lock_attr);
+    pthread_mutexattr_destroy(&lock_attr);
+
+    pthread_condattr_t done_attr;
+    pthread_condattr_init(&done_attr);
+    pthread_condattr_setpshared(&done_attr, PTHREAD_PROCESS_SHARED);
+    pthread_condattr_setclock(&done_attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&barrier->done, &done_attr);
+    pthread_condattr_destroy(&done_attr);
+
+    barrier->count = count;
+    barrier->arrived = 0;
+    barrier->round = 0;
+}
+
+// private function, waits until all of the barrier's processes have arrived
+// returns -1 if the processes on the other side of dt_train_distributed
+// went away in the meantime (see dt_dist_alive), since they never will
+int dt_dist_wait(dt_dist *d, dt_dist_barrier *barrier) {
+    if(pthread_mutex_lock(&barrier->lock) != 0) {
+        // the last holder of the lock died
+        pthread_mutex_unlock(&barrier->lock);
+        return -1;
+    }
+    unsigned int round = barrier->round;
+    barrier->arrived += 1;
+    if(barrier->arrived == barrier->count) {
+        barrier->arrived = 0;
+        barrier->round += 1;
+        pthread_cond_broadcast(&barrier->done);
+    }
+
+    int result = 0;
+    while(barrier->round == round) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_nsec += DT_DIST_POLL_MS * 1000000L;
+        if(deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec += 1;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        int error = pthread_cond_timedwait(&barrier->done, &barrier->lock, &deadline);
+        if(barrier->round != round) {
+            break;
+        }
+        if((error != 0 && error != ETIMEDOUT) || (error == ETIMEDOUT && !dt_dist_alive(d))) {
+            result = -1;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&barrier->lock);
+    return result;
+}
+
+// private function, dt_dist_wait for the workers, which have nothing to
+// clean up if the coordinator is gone
+void dt_dist_sync(dt_dist *d, dt_dist_barrier *barrier) {
+    if(dt_dist_wait(d, barrier) != 0) {
+        _exit(1);
+    }
 }
 
-int dt_train(decision_tree *dt, data_set *train_data) {
-    if(train_data->has_ydata == 0) {
-        fprintf(stderr, "Data set must have y data!\n");
-        return -1;
+// private function, whether the other side of dt_train_distributed is still
+// there: every worker for the coordinator, which reaps the first dead one it
+// finds, and the coordinator for a worker
+int dt_dist_alive(dt_dist *d) {
+    if(getpid() != d->coordinator) {
+        return getppid() == d->coordinator;
     }
-
-    // this comes in handy occasionally
-    dt->dataset = train_data;
-    int count = dt_split_on_node(dt->root, train_data, 0, dt->criterion);
-    printf("Decision tree has %d nodes\n", count);
-    return 0;
+    for(int w = 0; w < d->workers; w++) {
+        if(d->pids[w] > 0 && waitpid(d->pids[w], NULL, WNOHANG) != 0) {
+            d->pids[w] = -1;
+            return 0;
+        }
+    }
+    return 1;
 }
 
 float* dt_predict(decision_tree *dt, data_set *test_data) {
@@ -61,15 +1404,31 @@ float* dt_predict(decision_tree *dt, data_set *test_data) {
 
 // classify a single row in the data set
 float dt_classify(decision_tree *dt, data_set *data, int row) {
-    dt_node *node = dt->root;
+    return dt_predict_row(dt, data->x_data[row]);
+}
+
+float dt_predict_row(const decision_tree *dt, const float *x) {
+    return dt_predict_from(dt->root, x, 1);
+}
+
+void dt_predict_strided(const decision_tree *dt, const float *x, size_t rowcount,
+        ptrdiff_t row_stride, ptrdiff_t col_stride, float *preds) {
+    for(size_t i = 0; i < rowcount; i++) {
+        preds[i] = dt_predict_from(dt->root, x + (ptrdiff_t)i * row_stride, col_stride);
+    }
+}
+
+// private function, classifies the row whose feature j is x[j * col_stride]
+// starting at node. only reads the tree, so any number of threads can share it
+float dt_predict_from(const dt_node *node, const float *x, ptrdiff_t col_stride) {
     while(1) {
         if(node->is_leaf) {
             return node->prediction_value;
         }
 
-        float value = data->x_data[row][node->split_col];
-        if(value < node->split_value) {
-            dt_node *tmpnode = node->left;
+        float value = x[node->split_col * col_stride];
+        if(dt_goes_left(node, value)) {
+            const dt_node *tmpnode = node->left;
             if(tmpnode == NULL) {
                 tmpnode = node->right;
                 if(tmpnode == NULL) {
@@ -80,7 +1439,7 @@ float dt_classify(decision_tree *dt, data_set *data, int row) {
             node = tmpnode;
         }
         else {
-            dt_node *tmpnode = node->right;
+            const dt_node *tmpnode = node->right;
             if(tmpnode == NULL) {
                 tmpnode = node->left;
                 if(tmpnode == NULL) {
@@ -95,31 +1454,45 @@ float dt_classify(decision_tree *dt, data_set *data, int row) {
 
 // compute the score for the validation data set
 float dt_score(decision_tree *dt, data_set *validation_data) {
+    return dt_score_rows(dt, validation_data, NULL, validation_data->rowcount);
+}
+
+float dt_score_rows(decision_tree *dt, data_set *validation_data,
+        unsigned int *rows, unsigned int rowcount) {
     if(!validation_data->has_ydata) {
         fprintf(stderr, "Scoring data must have y data!\n");
         return 0.0;
     }
 
-    int total = validation_data->rowcount;
-    int correct = 0;
+    // weighted rows count as many times as their weight
+    double total = 0;
+    double correct = 0;
 
-    for(int i = 0; i < total; i++) {
-        float class = dt_classify(dt, validation_data, i);
-        float actual = validation_data->y_data[i];
+    for(unsigned int i = 0; i < rowcount; i++) {
+        int row = rows != NULL ? rows[i] : i;
+        float class = dt_classify(dt, validation_data, row);
+        float actual = validation_data->y_data[row];
+        float weight = ds_weight(validation_data, row);
+        total += weight;
         if(class == actual) {
-            correct += 1;
+            correct += weight;
         }
     }
 
-    float ratio = ((float)correct) / total;
+    float ratio = correct / total;
     return ratio;
 }
 
+
 dt_node* dt_new_node() {
     dt_node *node = malloc(sizeof(dt_node));
     node->is_leaf = 0;
     node->split_value = 0;
     node->prediction_value = 0;
+    node->train_error = 0;
+    node->prune_alpha = INFINITY;
+    node->categories = NULL;
+    node->category_count = 0;
     node->left = NULL;
     node->right = NULL;
     node->parent = NULL;
@@ -133,175 +1506,478 @@ void dt_free_node(dt_node *node) {
     }
     dt_free_node(node->left);
     dt_free_node(node->right);
+    free(node->categories);
     free(node);
 }
 
-// pick the best column to split on, based on the information gain metric
-int dt_pick_best_column(data_set *data, split_criterion criterion) {
-    float *gains = malloc(data->colcount * sizeof(float));
+int dt_goes_left(const dt_node *node, float value) {
+    if(node->categories != NULL) {
+        return DT_IN_CATEGORIES(node->categories, node->category_count, value);
+    }
+    return value < node->split_value;
+}
+
+// private function, whether col is categorical given dt_prepared.catcounts
+int dt_categorical(unsigned int *catcounts, int col) {
+    return catcounts != NULL && catcounts[col] > 0;
+}
+
+// private function, the category histogram slot of a value: its code, or
+// catcount for values that aren't a category code
+unsigned int dt_category_code(float value, unsigned int catcount) {
+    return value >= 0 && value < catcount ? (unsigned int)value : catcount;
+}
 
-    for(int col = 0; col < data->colcount; col++) {
-        // divide up the data based on the mean of the chosen column
-        float mean = ds_col_mean(data, col);
+// private function, allocates the categorical scratch space of a builder
+// for its catcounts (nothing if there are no categorical columns)
+void dt_build_alloc_categories(dt_build *b, int colcount) {
+    b->cathist = NULL;
+    b->catkeys = NULL;
+    b->set = NULL;
+    b->best_set = NULL;
+    if(b->catcounts == NULL) {
+        return;
+    }
+
+    unsigned int most = 0;
+    for(int col = 0; col < colcount; col++) {
+        if(b->catcounts[col] > most) {
+            most = b->catcounts[col];
+        }
+    }
+    b->cathist = malloc((most + 1) * b->classcount * sizeof(float));
+    b->catkeys = malloc((most + 1) * sizeof(dt_category_key));
+    b->set = malloc((DT_CATEGORY_WORDS(most) + 1) * sizeof(uint32_t));
+    b->best_set = malloc((DT_CATEGORY_WORDS(most) + 1) * sizeof(uint32_t));
+}
+
+// the best split of a categorical column with catcount categories, given
+// the class histogram of every category in hist (category k at
+// hist[k * classcount], and the values that aren't a category code, which
+// always go right, at k = catcount). the categories are ordered by the share
+// of the node's majority class among their rows, and every split between two
+// neighbours in that order is scored. the categories left of the best one are
+// stored in set, and its score is returned (-INFINITY if no split has rows on
+// both sides)
+float dt_category_split(dt_build *b, float parent_impurity, const float *hist,
+        unsigned int catcount, uint32_t *set) {
+    int classcount = b->classcount;
+
+    memset(b->lesser, 0, classcount * sizeof(float));
+    memset(b->greater, 0, classcount * sizeof(float));
+    for(unsigned int k = 0; k <= catcount; k++) {
+        for(int c = 0; c < classcount; c++) {
+            b->greater[c] += hist[k * classcount + c];
+        }
+    }
+    int majority = 0;
+    for(int c = 0; c < classcount; c++) {
+        if(b->greater[c] > b->greater[majority]) {
+            majority = c;
+        }
+    }
+
+    unsigned int present = 0;
+    for(unsigned int k = 0; k < catcount; k++) {
+        float weight = 0;
+        for(int c = 0; c < classcount; c++) {
+            weight += hist[k * classcount + c];
+        }
+        if(weight > 0) {
+            b->catkeys[present].share = hist[k * classcount + majority] / weight;
+            b->catkeys[present].code = k;
+            present += 1;
+        }
+    }
+    qsort(b->catkeys, present, sizeof(dt_category_key), dt_compare_category_keys);
 
-        data_set *lesser = ds_new(data->colcount, 1);
-        data_set *greater = ds_new(data->colcount, 1);
+    float other = 0;
+    for(int c = 0; c < classcount; c++) {
+        other += hist[catcount * classcount + c];
+    }
 
-        for(int row = 0; row < data->rowcount; row++) {
-            if(data->x_data[row][col] < mean) {
-                ds_add_item(lesser, data->x_data[row], data->y_data[row]);
+    // move the categories left one at a time, updating the impurity sums of
+    // the two sides for the classes that move instead of starting over
+    int entropy = b->criterion == CR_ENTROPY;
+    imp_side lesser_side;
+    imp_side greater_side;
+    if(entropy) {
+        imp_side_entropy(&lesser_side, b->lesser, classcount);
+        imp_side_entropy(&greater_side, b->greater, classcount);
+    }
+    else {
+        imp_side_gini(&lesser_side, b->lesser, classcount);
+        imp_side_gini(&greater_side, b->greater, classcount);
+    }
+    float best = -INFINITY;
+    unsigned int bestlen = 0;
+    for(unsigned int j = 0; j < present; j++) {
+        const float *counts = &hist[b->catkeys[j].code * classcount];
+        for(int c = 0; c < classcount; c++) {
+            if(counts[c] == 0) {
+                continue;
+            }
+            if(entropy) {
+                imp_move_entropy(&greater_side, &lesser_side, b->greater[c], b->lesser[c], counts[c]);
             }
             else {
-                ds_add_item(greater, data->x_data[row], data->y_data[row]);
+                imp_move_gini(&greater_side, &lesser_side, b->greater[c], b->lesser[c], counts[c]);
             }
+            b->lesser[c] += counts[c];
+            b->greater[c] -= counts[c];
+        }
+        if(j + 1 == present && other == 0) {
+            // nothing would be left on the right
+            break;
+        }
+
+        float gain = entropy ? imp_entropy_gain(parent_impurity, &lesser_side, &greater_side) :
+            imp_gini_score(&lesser_side, &greater_side);
+        if(gain > best) {
+            best = gain;
+            bestlen = j + 1;
+        }
+    }
+
+    memset(set, 0, DT_CATEGORY_WORDS(catcount) * sizeof(uint32_t));
+    for(unsigned int j = 0; j < bestlen; j++) {
+        unsigned int code = b->catkeys[j].code;
+        set[code / 32] |= (uint32_t)1 << (code % 32);
+    }
+    return best;
+}
+
+// private function, orders categories by falling majority class share, and
+// by code when the shares are equal
+int dt_compare_category_keys(const void *a, const void *b) {
+    const dt_category_key *ka = a;
+    const dt_category_key *kb = b;
+    if(ka->share != kb->share) {
+        return ka->share < kb->share ? 1 : -1;
+    }
+    return (ka->code > kb->code) - (ka->code < kb->code);
+}
+
+// mean of col over rows, weighted by the sample weights if there are any
+float dt_column_mean(data_set *data, unsigned int *rows, unsigned int rowcount, int col) {
+    double sum = 0;
+    if(data->weights == NULL) {
+        for(unsigned int i = 0; i < rowcount; i++) {
+            sum += data->x_data[rows[i]][col];
         }
+        return (float)(sum / rowcount);
+    }
+
+    double weight = 0;
+    for(unsigned int i = 0; i < rowcount; i++) {
+        sum += (double)data->x_data[rows[i]][col] * data->weights[rows[i]];
+        weight += data->weights[rows[i]];
+    }
+    return (float)(sum / weight);
+}
 
-        float main_splitscore;
-        float lesser_splitscore;
-        float greater_splitscore;
+// the split score of dividing rows on the mean of col, which is stored in mean
+// (or for categorical columns, on the best two sets of categories)
+float dt_column_gain(dt_build *b, unsigned int *rows, unsigned int rowcount,
+        int col, float parent_impurity, float *mean) {
+    data_set *data = b->data;
+    int classcount = b->classcount;
 
-        if(criterion == CR_ENTROPY) {
-            // entropy estimation for the whole data set and the two splits
-            main_splitscore = ds_entropy(data);
-            lesser_splitscore = ds_entropy(lesser);
-            greater_splitscore = ds_entropy(greater);
+    // categorical columns have no mean, they split into two sets of
+    // categories, which go into b->set
+    if(dt_categorical(b->catcounts, col)) {
+        unsigned int catcount = b->catcounts[col];
+        memset(b->cathist, 0, (catcount + 1) * classcount * sizeof(float));
+        for(unsigned int i = 0; i < rowcount; i++) {
+            unsigned int row = rows[i];
+            unsigned int k = dt_category_code(data->x_data[row][col], catcount);
+            b->cathist[k * classcount + b->labels[row]] += ds_weight(data, row);
         }
-        else if(criterion == CR_GINI) {
-            main_splitscore = ds_gini(data);
-            lesser_splitscore = ds_gini(lesser);
-            greater_splitscore = ds_gini(greater);
+        *mean = 0;
+        return dt_category_split(b, parent_impurity, b->cathist, catcount, b->set);
+    }
+
+    // divide up the data based on the mean of the chosen column
+    *mean = dt_column_mean(data, rows, rowcount, col);
+
+    memset(b->lesser, 0, classcount * sizeof(float));
+    memset(b->greater, 0, classcount * sizeof(float));
+    for(unsigned int i = 0; i < rowcount; i++) {
+        unsigned int row = rows[i];
+        if(data->x_data[row][col] < *mean) {
+            b->lesser[b->labels[row]] += ds_weight(data, row);
         }
         else {
-            fprintf(stderr, "Unknown criterion %d!\n", criterion);
-            return 0;
+            b->greater[b->labels[row]] += ds_weight(data, row);
         }
+    }
 
-        // ratios for split data sets
-        float lesser_frac = ((float)lesser->rowcount) / data->rowcount;
-        float greater_frac = ((float)greater->rowcount) / data->rowcount;
+    // this is either information gain if the splitscore is entropy
+    // or it is the total population diversity score if using gini
+    return dt_split_gain(b->criterion, parent_impurity,
+            b->lesser, b->greater, classcount);
+}
 
-        // this is either information gain if the splitscore is entropy
-        // or it is the total population diversity score if using gini
-        float gain;
-        if(criterion == CR_ENTROPY) {
-            gain = main_splitscore - ((lesser_frac * lesser_splitscore) +
-                    (greater_frac * greater_splitscore));
-        }
-        else if(criterion == CR_GINI) {
-            gain = (lesser_frac * lesser_splitscore) +
-                (greater_frac * greater_splitscore);
+// only the entropy gain depends on the unsplit rows, and they are the
+// same for every column
+float dt_parent_impurity(dt_build *b, float *counts) {
+    if(b->criterion != CR_ENTROPY) {
+        return 0;
+    }
+    float total = 0;
+    for(int c = 0; c < b->classcount; c++) {
+        total += counts[c];
+    }
+    return ds_entropy_counts(counts, b->classcount, total);
+}
+
+// private xorshift generator, so sampling only depends on the tree's seed
+float dt_build_random(dt_build *b) {
+    b->rng ^= b->rng << 13;
+    b->rng ^= b->rng >> 17;
+    b->rng ^= b->rng << 5;
+    return (b->rng >> 8) / 16777216.0f;
+}
+
+// stratified sample of rows into b->sample: every class keeps sample_rate of
+// its rows, spread evenly through the (stably partitioned) row list from a
+// random start. returns the number of sampled rows
+unsigned int dt_sample_rows(dt_build *b, unsigned int *rows, unsigned int rowcount) {
+    for(int c = 0; c < b->classcount; c++) {
+        b->sample_next[c] = dt_build_random(b);
+    }
+
+    unsigned int count = 0;
+    for(unsigned int i = 0; i < rowcount; i++) {
+        int c = b->labels[rows[i]];
+        b->sample_next[c] += b->sample_rate;
+        if(b->sample_next[c] >= 1) {
+            b->sample_next[c] -= 1;
+            b->sample[count] = rows[i];
+            count += 1;
         }
-        else {
-            fprintf(stderr, "Unknown criterion %d!\n", criterion);
-            return 0;
+    }
+    return count;
+}
+
+// pick the best column to split on, based on the information gain metric
+// counts is the class histogram of the rows, and the mean of the chosen
+// column is stored in split_value (or its categories in b->best_set)
+int dt_pick_best_column(dt_build *b, unsigned int *rows, unsigned int rowcount,
+        float *counts, float *split_value) {
+    int colcount = b->data->colcount;
+    float main_splitscore = dt_parent_impurity(b, counts);
+
+    // big nodes score every column on a sample of the rows first
+    unsigned int samplecount = 0;
+    if(b->sample_rate > 0 && b->sample_rate < 1 && rowcount >= b->sample_min_rows) {
+        samplecount = dt_sample_rows(b, rows, rowcount);
+    }
+
+    if(samplecount < 2) {
+        float best = 0;
+        int bestcol = 0;
+        for(int col = 0; col < colcount; col++) {
+            float mean;
+            float gain = dt_column_gain(b, rows, rowcount, col, main_splitscore, &mean);
+
+            // pick the best gain
+            if(col == 0 || gain > best) {
+                best = gain;
+                bestcol = col;
+                *split_value = mean;
+                dt_keep_split(b, col);
+            }
         }
+        return bestcol;
+    }
 
-        gains[col] = gain;
-        ds_free(lesser);
-        ds_free(greater);
+    float *sample_counts = calloc(b->classcount, sizeof(float));
+    float sample_total = 0;
+    for(unsigned int i = 0; i < samplecount; i++) {
+        float weight = ds_weight(b->data, b->sample[i]);
+        sample_counts[b->labels[b->sample[i]]] += weight;
+        sample_total += weight;
     }
+    float sample_splitscore = dt_parent_impurity(b, sample_counts);
 
-    // pick the best gain
-    float best = gains[0];
     int bestcol = 0;
-    for(int i = 0; i < data->colcount; i++) {
-        if(gains[i] > best) {
-            best = gains[i];
-            bestcol = i;
+    for(int col = 0; col < colcount; col++) {
+        float mean;
+        b->gains[col] = dt_column_gain(b, b->sample, samplecount, col, sample_splitscore, &mean);
+        if(b->gains[col] > b->gains[bestcol]) {
+            bestcol = col;
         }
     }
 
-    free(gains);
-    return bestcol;
-}
+    // gini scores are not relative to the parent, so measure how close the
+    // candidates are against the score of not splitting at all
+    float baseline = 0;
+    if(b->criterion == CR_GINI) {
+        baseline = ds_gini_counts(sample_counts, b->classcount, sample_total);
+    }
+    free(sample_counts);
+    float margin = b->sample_tolerance * fabsf(b->gains[bestcol] - baseline);
 
+    // every column the sample can't tell apart from the best one is
+    // re-scored on all of the rows
+    int close = 0;
+    for(int col = 0; col < colcount; col++) {
+        if(col != bestcol && b->gains[bestcol] - b->gains[col] <= margin) {
+            close += 1;
+        }
+    }
+    if(close == 0) {
+        if(dt_categorical(b->catcounts, bestcol)) {
+            dt_column_gain(b, rows, rowcount, bestcol, main_splitscore, split_value);
+            dt_keep_split(b, bestcol);
+        }
+        else {
+            *split_value = dt_column_mean(b->data, rows, rowcount, bestcol);
+        }
+        return bestcol;
+    }
 
-// returns 0 if all y values are the same
-// 1 otherwise
-int dt_should_split(data_set *data) {
-    int last_seen = data->y_data[0];
-    for(int i = 0; i < data->rowcount; i++) {
-        if(data->y_data[i] != last_seen) {
-            return 1;
+    float best = 0;
+    int exactcol = -1;
+    for(int col = 0; col < colcount; col++) {
+        if(b->gains[bestcol] - b->gains[col] > margin) {
+            continue;
+        }
+        float mean;
+        float gain = dt_column_gain(b, rows, rowcount, col, main_splitscore, &mean);
+        if(exactcol < 0 || gain > best) {
+            best = gain;
+            exactcol = col;
+            *split_value = mean;
+            dt_keep_split(b, col);
         }
     }
-    return 0;
+    return exactcol;
 }
 
 
-int dt_split_on_node(dt_node *node, data_set *train_data, int depth, split_criterion criterion) {
-    if(!dt_should_split(train_data)) {
-        // all y values are the same, so make a leaf!
-        node->is_leaf = 1;
-        node->prediction_value = train_data->y_data[0];
-        return 1;
-    }
-    else if(train_data->rowcount < 1) {
-        // this is generally a bad place to be
-        // should never happen
-        fprintf(stderr, "No rows left in training set!\n");
-        return 1;
+// private function, saves the categories of a categorical split that
+// dt_column_gain just scored as the best one
+void dt_keep_split(dt_build *b, int col) {
+    if(dt_categorical(b->catcounts, col)) {
+        memcpy(b->best_set, b->set, DT_CATEGORY_WORDS(b->catcounts[col]) * sizeof(uint32_t));
     }
+}
 
-    // pick the best column based in info gain
-    unsigned int col = dt_pick_best_column(train_data, criterion);
+float dt_split_gain(split_criterion criterion, float parent_impurity,
+        const float *lesser, const float *greater, int classcount) {
+    imp_side lesser_side;
+    imp_side greater_side;
+    if(criterion == CR_ENTROPY) {
+        imp_side_entropy(&lesser_side, lesser, classcount);
+        imp_side_entropy(&greater_side, greater, classcount);
+        return imp_entropy_gain(parent_impurity, &lesser_side, &greater_side);
+    }
+    imp_side_gini(&lesser_side, lesser, classcount);
+    imp_side_gini(&greater_side, greater, classcount);
+    return imp_gini_score(&lesser_side, &greater_side);
+}
 
-    // split on the mean of the column
-    node->split_value = ds_col_mean(train_data, col);
-    node->split_col = col;
+// rows is partitioned in place: the rows that go to the left child end up
+// at the front of the list, in their original order
+int dt_build_node(dt_build *b, dt_node *node, unsigned int *rows, unsigned int rowcount, int depth) {
+    data_set *data = b->data;
 
-    // make a new data set for all of the rows less than the mean
-    data_set *lesser_data = ds_new(train_data->colcount, 1);
+    float *counts = calloc(b->classcount, sizeof(float));
+    int present = 0;
+    for(unsigned int i = 0; i < rowcount; i++) {
+        counts[b->labels[rows[i]]] += ds_weight(data, rows[i]);
+    }
 
-    // add all rows < mean
-    for(int i = 0; i < train_data->rowcount; i++) {
-        float val = train_data->x_data[i][col];
-        if(val < node->split_value) {
-            ds_add_item(lesser_data, train_data->x_data[i], train_data->y_data[i]);
+    // every node remembers the most common class of its rows, so that it
+    // can be turned into a leaf by pruning
+    int majority = 0;
+    for(int c = 0; c < b->classcount; c++) {
+        if(counts[c] > 0) {
+            present += 1;
         }
+        if(counts[c] > counts[majority]) {
+            majority = c;
+        }
+    }
+    node->prediction_value = b->classes[majority];
+    float total = 0;
+    for(int c = 0; c < b->classcount; c++) {
+        total += counts[c];
     }
+    node->train_error = total - counts[majority];
 
-    int c1 = 0;
-    if(lesser_data->rowcount > 0) {
-        // if we have data that was less than the mean (should always happen)
-        // then recurse on that new data set
-        dt_node *left_node = dt_new_node();
-        left_node->is_lesser = 1;
-        node->left = left_node;
-        c1 = dt_split_on_node(left_node, lesser_data, depth+1, criterion);
+    if(present <= 1) {
+        // all y values are the same, so make a leaf!
+        free(counts);
+        node->is_leaf = 1;
+        return 1;
     }
-    else {
-        node->left = NULL;
+
+    if(b->max_depth > 0 && depth >= b->max_depth) {
+        // too deep to split any further, the most common class will do
+        free(counts);
+        node->is_leaf = 1;
+        return 1;
     }
-    ds_free(lesser_data);
 
-    // make a data set for values >= mean
-    data_set *greater_data = ds_new(train_data->colcount, 1);
+    // pick the best column based in info gain, and split on its mean
+    float split_value = 0;
+    unsigned int col = dt_pick_best_column(b, rows, rowcount, counts, &split_value);
+    free(counts);
+    node->split_value = split_value;
+    node->split_col = col;
+    if(dt_categorical(b->catcounts, col)) {
+        size_t bytes = DT_CATEGORY_WORDS(b->catcounts[col]) * sizeof(uint32_t);
+        node->categories = malloc(bytes);
+        memcpy(node->categories, b->best_set, bytes);
+        node->category_count = b->catcounts[col];
+    }
 
-    for(int i = 0; i < train_data->rowcount; i++) {
-        float val = train_data->x_data[i][col];
-        if(val >= node->split_value) {
-            ds_add_item(greater_data, train_data->x_data[i], train_data->y_data[i]);
+    // all rows < mean (or in the categories) go to the front, the rest to
+    // the back
+    unsigned int lesser_count = 0;
+    unsigned int greater_count = 0;
+    for(unsigned int i = 0; i < rowcount; i++) {
+        unsigned int row = rows[i];
+        if(dt_goes_left(node, data->x_data[row][col])) {
+            rows[lesser_count] = row;
+            lesser_count += 1;
+        }
+        else {
+            b->scratch[greater_count] = row;
+            greater_count += 1;
         }
     }
+    memcpy(rows + lesser_count, b->scratch, greater_count * sizeof(unsigned int));
 
-    int c2 = 0;
-    if(greater_data->rowcount > 0) {
-        // recurse on the new data set
-        dt_node *right_node = dt_new_node();
-        node->right = right_node;
-        right_node->is_lesser = 0;
-        c2 = dt_split_on_node(right_node, greater_data, depth+1, criterion);
-    }
-    else {
-        node->right = NULL;
+    if(lesser_count == 0 || greater_count == 0) {
+        // the mean doesn't separate these rows (they are identical in every
+        // column), so no split can. settle for the most common class
+        free(node->categories);
+        node->categories = NULL;
+        node->is_leaf = 1;
+        return 1;
     }
-    ds_free(greater_data);
+
+    dt_node *left_node = dt_new_node();
+    left_node->is_lesser = 1;
+    left_node->parent = node;
+    node->left = left_node;
+    int c1 = dt_build_node(b, left_node, rows, lesser_count, depth+1);
+
+    dt_node *right_node = dt_new_node();
+    right_node->is_lesser = 0;
+    right_node->parent = node;
+    node->right = right_node;
+    int c2 = dt_build_node(b, right_node, rows + lesser_count, greater_count, depth+1);
 
     // return a count of all of the decendent nodes for the current node
     return c1+c2;
 }
 
+
 // private function, returns a count of all children of the specified node plus
 // the node itself (children + 1)
 int count_nodes(dt_node *node) {
@@ -315,9 +1991,10 @@ int count_nodes(dt_node *node) {
 // and only accepts a pruning if it increases the prediction score of the
 // validation data
 // returns the number of nodes successfully pruned
-int prune_node(decision_tree *dt, dt_node *node, data_set *validation_data) {
+int prune_node(decision_tree *dt, dt_node *node, data_set *validation_data,
+        unsigned int *rows, unsigned int rowcount) {
     // the score with both subtrees still attached
-    float primary_score = dt_score(dt, validation_data);
+    float primary_score = dt_score_rows(dt, validation_data, rows, rowcount);
 
     // save subtrees so that we can restore them if classification score
     // didn't improve
@@ -330,7 +2007,7 @@ int prune_node(decision_tree *dt, dt_node *node, data_set *validation_data) {
         node->left = NULL;
 
         // score the decision tree with the missing subtree
-        float left_prune_score = dt_score(dt, validation_data);
+        float left_prune_score = dt_score_rows(dt, validation_data, rows, rowcount);
         if(left_prune_score >= primary_score) {
             // found a good prune!
             left_prune_count = count_nodes(left);
@@ -345,7 +2022,7 @@ int prune_node(decision_tree *dt, dt_node *node, data_set *validation_data) {
         else {
             // prune was no good, so restore the subtree and recurse
             node->left = left;
-            left_prune_count = prune_node(dt, node->left, validation_data);
+            left_prune_count = prune_node(dt, node->left, validation_data, rows, rowcount);
         }
     }
 
@@ -353,7 +2030,7 @@ int prune_node(decision_tree *dt, dt_node *node, data_set *validation_data) {
         // basically the same as above, but for the right subtree
         node->right = NULL;
 
-        float right_prune_score = dt_score(dt, validation_data);
+        float right_prune_score = dt_score_rows(dt, validation_data, rows, rowcount);
         if(right_prune_score >= primary_score) {
             right_prune_count = count_nodes(right);
             float diff = right_prune_score - primary_score;
@@ -365,7 +2042,7 @@ int prune_node(decision_tree *dt, dt_node *node, data_set *validation_data) {
         }
         else {
             node->right = right;
-            right_prune_count = prune_node(dt, node->right, validation_data);
+            right_prune_count = prune_node(dt, node->right, validation_data, rows, rowcount);
         }
     }
 
@@ -381,85 +2058,432 @@ int prune_node(decision_tree *dt, dt_node *node, data_set *validation_data) {
 // this is a public function for attempting to prune the decision tree and
 // improve classification
 int dt_prune(decision_tree *dt, data_set *validation_data) {
-    return prune_node(dt, dt->root, validation_data);
+    return prune_node(dt, dt->root, validation_data, NULL, validation_data->rowcount);
 }
 
+int dt_prune_rows(decision_tree *dt, data_set *validation_data,
+        unsigned int *rows, unsigned int rowcount) {
+    return prune_node(dt, dt->root, validation_data, rows, rowcount);
+}
 // this is used by the pruning step. sometimes a node has both of its
-// children pruned, so it needs to become a leaf node. this function
-// returns the most common class of samples that end up at that leaf
+// children pruned, so it needs to become a leaf node. the trainers store the
+// most common class of the training samples that reach every node, and that
+// is what the new leaf predicts
 float guess_node_class(decision_tree *dt, dt_node *leaf_node) {
     if(leaf_node->left != NULL || leaf_node->right != NULL) {
         fprintf(stderr, "Can't guess class of non-leaf node!\n");
         return 0;
     }
 
-    if(leaf_node->is_leaf) {
-        return leaf_node->prediction_value;
+    return leaf_node->prediction_value;
+}
+
+// the breakpoints of the cost function of a subtree: at alpha, the optimal
+// subtree loses `leaves` leaves and `nodes` nodes, and gains `error` error
+typedef struct ccp_event {
+    float alpha;
+    int leaves;
+    int nodes;
+    float error;
+} ccp_event;
+
+typedef struct ccp_list {
+    ccp_event *events;
+    int count;
+    // the full subtree
+    int leaves;
+    int nodes;
+    float error;
+} ccp_list;
+
+// private function, computes the collapse alpha of every node under `node`
+// bottom up. the breakpoints of both children are merged in alpha order and
+// walked until collapsing `node` is cheaper than keeping the remaining
+// subtree; breakpoints past that point are subsumed by the collapse
+ccp_list ccp_node(dt_node *node) {
+    ccp_list list;
+    list.events = NULL;
+    list.count = 0;
+
+    if(node->is_leaf || (node->left == NULL && node->right == NULL)) {
+        node->prune_alpha = INFINITY;
+        list.leaves = 1;
+        list.nodes = 1;
+        list.error = node->train_error;
+        return list;
+    }
+
+    ccp_list left = {NULL, 0, 0, 0, 0};
+    ccp_list right = {NULL, 0, 0, 0, 0};
+    if(node->left != NULL) {
+        left = ccp_node(node->left);
+    }
+    if(node->right != NULL) {
+        right = ccp_node(node->right);
     }
 
-    int found_root = 0;
-    int classcount;
-    float *classes = ds_classes(dt->dataset, &classcount);
-    int *classcounts = malloc(classcount * sizeof(int));
-    memset(classcounts, 0, classcount * sizeof(int));
-
-    // to do this, we go from our node of choice, and try to see
-    // if we can get to the root for each sample
-    dt_node *curnode = leaf_node;
-    for(int row = 0; row < dt->dataset->rowcount; row++) {
-        while(curnode != NULL) {
-            if(curnode == dt->root) {
-                found_root = 1;
-                // row was classified by our node! count its class
-                for(int c = 0; c < classcount; c++) {
-                    if(classes[c] == dt->dataset->y_data[row]) {
-                        classcounts[c] += 1;
-                        break;
-                    }
-                }
-                break;
+    list.events = malloc((left.count + right.count + 1) * sizeof(ccp_event));
+    list.leaves = left.leaves + right.leaves;
+    list.nodes = left.nodes + right.nodes + 1;
+    list.error = left.error + right.error;
+
+    int leaves = list.leaves;
+    int nodes = list.nodes;
+    float error = list.error;
+    float last_alpha = 0;
+    int l = 0;
+    int r = 0;
+    float alpha;
+    while(1) {
+        if(leaves > 1) {
+            alpha = (node->train_error - error) / (leaves - 1);
+        }
+        else {
+            // a chain of single-child nodes above one leaf, collapsing it
+            // only changes the error
+            alpha = node->train_error <= error ? last_alpha : INFINITY;
+        }
+        if(alpha < last_alpha) {
+            alpha = last_alpha;
+        }
+
+        ccp_event *next = NULL;
+        if(l < left.count && (r >= right.count || left.events[l].alpha <= right.events[r].alpha)) {
+            next = &left.events[l];
+        }
+        else if(r < right.count) {
+            next = &right.events[r];
+        }
+
+        if(next == NULL || alpha <= next->alpha) {
+            break;
+        }
+
+        // part of the subtree collapses before this node does
+        list.events[list.count] = *next;
+        list.count += 1;
+        leaves -= next->leaves;
+        nodes -= next->nodes;
+        error += next->error;
+        last_alpha = next->alpha;
+        if(next == &left.events[l]) {
+            l += 1;
+        }
+        else {
+            r += 1;
+        }
+    }
+
+    node->prune_alpha = alpha;
+    if(alpha < INFINITY) {
+        list.events[list.count].alpha = alpha;
+        list.events[list.count].leaves = leaves - 1;
+        list.events[list.count].nodes = nodes - 1;
+        list.events[list.count].error = node->train_error - error;
+        list.count += 1;
+    }
+
+    free(left.events);
+    free(right.events);
+    return list;
+}
+
+dt_ccp_path* dt_ccp_compute(decision_tree *dt) {
+    ccp_list list = ccp_node(dt->root);
+
+    dt_ccp_path *path = malloc(sizeof(dt_ccp_path));
+    path->steps = malloc((list.count + 1) * sizeof(dt_ccp_step));
+    path->steps[0].alpha = 0;
+    path->steps[0].leaves = list.leaves;
+    path->steps[0].nodes = list.nodes;
+    path->steps[0].train_error = list.error;
+    path->count = 1;
+
+    // several subtrees can collapse at the same alpha, that is one step
+    for(int i = 0; i < list.count; i++) {
+        dt_ccp_step *last = &path->steps[path->count - 1];
+        dt_ccp_step step = *last;
+        step.alpha = list.events[i].alpha;
+        step.leaves -= list.events[i].leaves;
+        step.nodes -= list.events[i].nodes;
+        step.train_error += list.events[i].error;
+        if(path->count > 1 && last->alpha == step.alpha) {
+            *last = step;
+        }
+        else {
+            path->steps[path->count] = step;
+            path->count += 1;
+        }
+    }
+
+    free(list.events);
+    return path;
+}
+
+void dt_ccp_free(dt_ccp_path *path) {
+    if(path == NULL) {
+        return;
+    }
+    free(path->steps);
+    free(path);
+}
+
+// private function, collapses every node whose alpha is at most `alpha`
+int prune_alpha_node(dt_node *node, float alpha) {
+    if(node == NULL || node->is_leaf) {
+        return 0;
+    }
+
+    if(node->prune_alpha <= alpha) {
+        int pruned = count_nodes(node->left) + count_nodes(node->right);
+        dt_free_node(node->left);
+        dt_free_node(node->right);
+        node->left = NULL;
+        node->right = NULL;
+        // the trainers left the majority class in prediction_value
+        node->is_leaf = 1;
+        node->prune_alpha = INFINITY;
+        return pruned;
+    }
+
+    return prune_alpha_node(node->left, alpha) + prune_alpha_node(node->right, alpha);
+}
+
+int dt_prune_alpha(decision_tree *dt, float alpha) {
+    return prune_alpha_node(dt->root, alpha);
+}
+
+int dt_prune_to_size(decision_tree *dt, dt_ccp_path *path, int max_nodes) {
+    for(int i = 0; i < path->count; i++) {
+        if(path->steps[i].nodes <= max_nodes) {
+            return i == 0 ? 0 : dt_prune_alpha(dt, path->steps[i].alpha);
+        }
+    }
+    // not even the root alone fits, that's as small as it gets
+    return dt_prune_alpha(dt, path->steps[path->count - 1].alpha);
+}
+
+// private per-node state of dt_prune_to_budget, indexed in preorder
+typedef struct budget_node {
+    dt_node *node;
+    int parent;
+    // one past the last node of the original subtree
+    int end;
+    // validation weight at this node that collapsing it would get right
+    double leaf_correct;
+    // validation weight the current subtree gets right
+    double subtree_correct;
+    int size;
+    int alive;
+    unsigned int version;
+} budget_node;
+
+// private heap entry, the validation accuracy lost per node removed by
+// collapsing a node. entries go stale when the node's subtree changes
+typedef struct budget_entry {
+    double cost;
+    int node;
+    unsigned int version;
+} budget_entry;
+
+int budget_before(budget_entry *a, budget_entry *b) {
+    return a->cost < b->cost || (a->cost == b->cost && a->node < b->node);
+}
+
+void budget_push(budget_entry *heap, int *count, budget_entry entry) {
+    int i = *count;
+    *count += 1;
+    while(i > 0 && budget_before(&entry, &heap[(i - 1) / 2])) {
+        heap[i] = heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    heap[i] = entry;
+}
+
+budget_entry budget_pop(budget_entry *heap, int *count) {
+    budget_entry top = heap[0];
+    *count -= 1;
+    budget_entry last = heap[*count];
+    int i = 0;
+    while(2 * i + 1 < *count) {
+        int child = 2 * i + 1;
+        if(child + 1 < *count && budget_before(&heap[child + 1], &heap[child])) {
+            child += 1;
+        }
+        if(!budget_before(&heap[child], &last)) {
+            break;
+        }
+        heap[i] = heap[child];
+        i = child;
+    }
+    heap[i] = last;
+    return top;
+}
+
+// private function, queues node i with its current cost if it can collapse
+void budget_queue(budget_node *nodes, int i, budget_entry **heap, int *heapcount, int *heapcap) {
+    dt_node *node = nodes[i].node;
+    if(node->is_leaf || (node->left == NULL && node->right == NULL)) {
+        return;
+    }
+    budget_entry entry;
+    entry.cost = (nodes[i].subtree_correct - nodes[i].leaf_correct) / (nodes[i].size - 1);
+    entry.node = i;
+    entry.version = nodes[i].version;
+    if(*heapcount == *heapcap) {
+        *heapcap *= 2;
+        *heap = realloc(*heap, *heapcap * sizeof(budget_entry));
+    }
+    budget_push(*heap, heapcount, entry);
+}
+
+dt_budget_curve* dt_prune_to_budget(decision_tree *dt, data_set *validation_data, size_t max_nodes) {
+    if(!validation_data->has_ydata) {
+        fprintf(stderr, "Pruning data must have y data!\n");
+        return NULL;
+    }
+    if(max_nodes < 1) {
+        max_nodes = 1;
+    }
+
+    // number the nodes in preorder, so every subtree is a range of indices
+    int n = dt_node_count(dt);
+    budget_node *nodes = malloc(n * sizeof(budget_node));
+    int *stack = malloc(n * sizeof(int));
+    dt_node **pending = malloc(n * sizeof(dt_node*));
+    int depth = 1;
+    int count = 0;
+    pending[0] = dt->root;
+    stack[0] = -1;
+    while(depth > 0) {
+        depth -= 1;
+        dt_node *node = pending[depth];
+        nodes[count].node = node;
+        nodes[count].parent = stack[depth];
+        nodes[count].leaf_correct = 0;
+        nodes[count].subtree_correct = 0;
+        nodes[count].size = 1;
+        nodes[count].alive = 1;
+        nodes[count].version = 0;
+        if(node->right != NULL) {
+            pending[depth] = node->right;
+            stack[depth] = count;
+            depth += 1;
+        }
+        if(node->left != NULL) {
+            pending[depth] = node->left;
+            stack[depth] = count;
+            depth += 1;
+        }
+        count += 1;
+    }
+    free(pending);
+    free(stack);
+
+    // children come after their parents, so sizes add up back to front
+    for(int i = n - 1; i > 0; i--) {
+        nodes[nodes[i].parent].size += nodes[i].size;
+    }
+    for(int i = 0; i < n; i++) {
+        nodes[i].end = i + nodes[i].size;
+    }
+
+    // route the validation rows the same way dt_classify does, crediting
+    // every node on the way that would get the row right as a leaf, and the
+    // node the row ends at if it gets it right now
+    double total = 0;
+    for(int row = 0; row < validation_data->rowcount; row++) {
+        float *x = validation_data->x_data[row];
+        float y = validation_data->y_data[row];
+        float weight = ds_weight(validation_data, row);
+        total += weight;
+
+        int i = 0;
+        while(1) {
+            dt_node *node = nodes[i].node;
+            if(node->prediction_value == y) {
+                nodes[i].leaf_correct += weight;
             }
-            float split_val = curnode->split_value;
-            unsigned int split_col = curnode->split_col;
-            if(curnode->is_lesser) {
-                if(dt->dataset->x_data[row][split_col] < split_val) {
-                    curnode = curnode->parent;
-                }
-                else {
-                    // the sample was not classified by our node of choice
-                    // move on to the next sample
-                    break;
+            if(node->is_leaf || (node->left == NULL && node->right == NULL)) {
+                float class = node->is_leaf ? node->prediction_value : 2;
+                if(class == y) {
+                    nodes[i].subtree_correct += weight;
                 }
+                break;
             }
-            else {
-                if(dt->dataset->x_data[row][split_col] >= split_val) {
-                    curnode = curnode->parent;
-                }
-                else {
-                    // the sample was not classified by our node of choice
-                    // move on to the next sample
-                    break;
-                }
+            dt_node *next = dt_goes_left(node, x[node->split_col]) ? node->left : node->right;
+            if(next == NULL) {
+                next = node->left != NULL ? node->left : node->right;
             }
+            // the child of i in preorder is either i+1 or after the left subtree
+            i = next == node->left ? i + 1 : i + 1 + (node->left != NULL ? nodes[i + 1].size : 0);
         }
     }
+    for(int i = n - 1; i > 0; i--) {
+        nodes[nodes[i].parent].subtree_correct += nodes[i].subtree_correct;
+    }
 
-    int best = classcounts[0];
-    float bestclass = classes[0];
-    for(int i = 0; i < classcount; i++) {
-        if(classcounts[i] > best) {
-            bestclass = classes[i];
-            best = classcounts[i];
-        }
+    int heapcap = n;
+    int heapcount = 0;
+    budget_entry *heap = malloc(heapcap * sizeof(budget_entry));
+    for(int i = 0; i < n; i++) {
+        budget_queue(nodes, i, &heap, &heapcount, &heapcap);
     }
 
-    if(!found_root) {
-        fprintf(stderr, "Failed to find the root when guessing the class... (classcount was %d)\n", best);
+    dt_budget_curve *curve = malloc(sizeof(dt_budget_curve));
+    curve->steps = malloc(n * sizeof(dt_budget_step));
+    curve->steps[0].nodes = n;
+    curve->steps[0].score = total > 0 ? nodes[0].subtree_correct / total : 0;
+    curve->count = 1;
+
+    // collapse the cheapest node until the tree fits
+    while((size_t)nodes[0].size > max_nodes && heapcount > 0) {
+        budget_entry entry = budget_pop(heap, &heapcount);
+        budget_node *bn = &nodes[entry.node];
+        if(!bn->alive || entry.version != bn->version || bn->node->is_leaf) {
+            continue;
+        }
+
+        for(int i = entry.node + 1; i < bn->end; i++) {
+            nodes[i].alive = 0;
+        }
+        dt_node *node = bn->node;
+        dt_free_node(node->left);
+        dt_free_node(node->right);
+        node->left = NULL;
+        node->right = NULL;
+        // the trainers left the majority class in prediction_value
+        node->is_leaf = 1;
+        node->prune_alpha = INFINITY;
+
+        int removed = bn->size - 1;
+        double lost = bn->subtree_correct - bn->leaf_correct;
+        bn->size = 1;
+        bn->subtree_correct = bn->leaf_correct;
+
+        // the ancestors' costs change with their subtrees
+        for(int a = bn->parent; a >= 0; a = nodes[a].parent) {
+            nodes[a].size -= removed;
+            nodes[a].subtree_correct -= lost;
+            nodes[a].version += 1;
+            budget_queue(nodes, a, &heap, &heapcount, &heapcap);
+        }
+
+        dt_budget_step *step = &curve->steps[curve->count];
+        step->nodes = nodes[0].size;
+        step->score = total > 0 ? nodes[0].subtree_correct / total : 0;
+        curve->count += 1;
     }
 
-    free(classes);
-    free(classcounts);
-    return bestclass;
+    free(heap);
+    free(nodes);
+    return curve;
 }
 
-
+void dt_budget_free(dt_budget_curve *curve) {
+    if(curve == NULL) {
+        return;
+    }
+    free(curve->steps);
+    free(curve);
+}
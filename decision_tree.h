@@ -1,7 +1,25 @@
 #pragma once
 
+#include <stddef.h>
+#include <stdint.h>
 #include "data_set.h"
 
+// defaults for decision_tree.sample_min_rows and sample_tolerance
+#define DT_SAMPLE_MIN_ROWS 5000
+#define DT_SAMPLE_TOLERANCE 0.05
+
+// categorical columns can have category codes 0 up to this, values outside
+// of that range are a category of their own that always goes right
+#define DT_MAX_CATEGORIES 65536
+
+// whether value v is one of the categories in the bitset set, which covers
+// the codes below count. bit k of set[k / 32] stands for category code k
+#define DT_IN_CATEGORIES(set, count, v) ((v) >= 0 && (v) < (count) && \
+        (((set)[(uint32_t)(v) / 32] >> ((uint32_t)(v) % 32)) & 1))
+
+// the number of 32 bit words in a bitset of count categories
+#define DT_CATEGORY_WORDS(count) (((count) + 31) / 32)
+
 typedef enum split_criterion {
     CR_GINI,
     CR_ENTROPY
@@ -13,6 +31,17 @@ typedef struct dt_node {
     int is_leaf;
     int is_lesser;
     float prediction_value;
+    // training rows that reach this node but aren't of its majority class,
+    // i.e. the training error of the node if it were a leaf
+    float train_error;
+    // the cost-complexity alpha at which this node becomes a leaf, set by
+    // dt_ccp_compute (infinite for leaves)
+    float prune_alpha;
+    // categorical splits send the categories in this bitset (of
+    // category_count bits) left and everything else right, NULL for numeric
+    // splits, which send values < split_value left
+    uint32_t *categories;
+    unsigned int category_count;
     struct dt_node *left;
     struct dt_node *right;
     struct dt_node *parent;
@@ -22,8 +51,46 @@ typedef struct decision_tree {
     dt_node *root;
     data_set *dataset;
     split_criterion criterion;
+    // nodes at this depth (the root is depth 0) become leaves
+    // 0 means no limit, which is what dt_new sets
+    int max_depth;
+    // the seed given to dt_new (or the time it used instead)
+    unsigned int seed;
+    // approximate split search: nodes with at least sample_min_rows rows
+    // pick their split column by scoring every column on a stratified
+    // sample_rate fraction of the rows, drawn with the tree's seed. columns
+    // whose sampled score is within sample_tolerance (relative to the best
+    // gain) of the best one are re-scored exactly on all of the rows, and
+    // the split value is always the exact mean. dt_new sets sample_rate to
+    // 0, which means every node is searched exactly
+    float sample_rate;
+    unsigned int sample_min_rows;
+    float sample_tolerance;
 } decision_tree;
 
+// training rows with their y values label encoded, made once by dt_prepare
+// and shared (read only) by any number of dt_train_prepared calls
+typedef struct dt_prepared {
+    data_set *data;
+    unsigned int rowcount;
+    unsigned int *rows;
+    int classcount;
+    float *classes;
+    // indexed by row of data, holds the index into classes
+    int *labels;
+    // the number of category codes of every categorical column (one more
+    // than the highest code, at most DT_MAX_CATEGORIES) and 0 for numeric
+    // columns. NULL if data has no categorical columns
+    unsigned int *catcounts;
+} dt_prepared;
+
+// allocate an empty node, for code that grows trees outside of dt_train
+dt_node* dt_new_node();
+
+// whether a row whose split column holds value goes to the left child of an
+// internal node
+int dt_goes_left(const dt_node *node, float value);
+
 // create a new decision tree
 // if seed is zero, the current time will be used instead
 // criterion should be one of CR_GINI or CR_ENTROPY
@@ -40,24 +107,144 @@ int dt_node_count(decision_tree *dt);
 
 // train the decision tree on the given data set
 // train_data REQUIRES Y data.
+// numeric columns are split at their mean. columns declared with
+// ds_set_categorical are split into two sets of categories: the categories
+// are ordered by how common the node's majority class is among their rows
+// and the best split between two neighbours in that order is taken (which is
+// the best of all subsets when there are two classes)
 int dt_train(decision_tree *dt, data_set *train_data);
 
+// same as dt_train, but builds the tree one level at a time instead of one
+// node at a time. every row is tagged with the node it has reached, and each
+// level takes two sequential passes over all of the rows: one for the column
+// means of every open node at once, one for the class counts on each side of
+// them. there is no recursion, so the depth of the tree is unlimited, and the
+// tree is identical to the one dt_train builds (sample_rate is ignored)
+int dt_train_levelwise(decision_tree *dt, data_set *train_data);
+
+// same as dt_train_levelwise, with the rows split between `workers` forked
+// worker processes (less than 1 means one per CPU). each worker owns a
+// contiguous shard of the training rows and adds them to the statistics of
+// the open nodes, which live in shared memory. the calling process is the
+// coordinator: it picks the splits from the statistics and hands them back
+// to the workers, which send their rows down them. the column sums are
+// added up in a wavefront over blocks of nodes and columns, each worker
+// following the one before it, so they come out in the same order as in
+// dt_train. the class histograms are counted by each worker for its own
+// shard and merged, as long as the weights are whole numbers (or there are
+// none), which keeps them exact; otherwise they go through the wavefront
+// too. either way the tree is identical to the one dt_train builds
+// if a worker dies the training stops with -1, leaving the open nodes
+// as leaves
+int dt_train_distributed(decision_tree *dt, data_set *train_data, int workers);
+
+// train on a subset of the rows of train_data, given as a list of row indices
+// (NULL means the first rowcount rows). the data is not copied
+int dt_train_rows(decision_tree *dt, data_set *train_data, unsigned int *rows, unsigned int rowcount);
+
+// do the per-data-set work of training once, for rows of train_data (NULL
+// for the first rowcount rows). train_data must outlive the result
+dt_prepared* dt_prepare(data_set *train_data, unsigned int *rows, unsigned int rowcount);
+void dt_prepared_free(dt_prepared *prep);
+
+// train on prepared rows. safe to call from several threads with the same prep
+int dt_train_prepared(decision_tree *dt, dt_prepared *prep);
+
 // return an array of predicted classes for test_data
 // the length of the array is equal to the number of rows in test_data
 // the array should be freed after use (bad C style, I know)
 float* dt_predict(decision_tree *dt, data_set *test_data);
 
+// classify one row of features, x[j] being the value of column j
+// allocation-free and read-only, so it is safe to call from any number of
+// threads at once (as long as nothing is training or pruning the tree)
+float dt_predict_row(const decision_tree *dt, const float *x);
+
+// classify rowcount rows straight out of a caller-owned buffer: column j of
+// row i is x[i * row_stride + j * col_stride], so both row-major
+// (row_stride = colcount, col_stride = 1) and column-major buffers work.
+// preds must hold rowcount floats. allocation-free and thread-safe like
+// dt_predict_row
+void dt_predict_strided(const decision_tree *dt, const float *x, size_t rowcount,
+        ptrdiff_t row_stride, ptrdiff_t col_stride, float *preds);
+
 // return a scoring value based on how accurate the predictions
 // for validation_data were. validation_data REQUIRES Y data.
 // the return value is 1.0 for perfect prediction, and 0.0 if none of the
 // samples were predicted correctly
 float dt_score(decision_tree *dt, data_set *validation_data);
 
+// dt_score and dt_prune for a subset of the rows of validation_data
+float dt_score_rows(decision_tree *dt, data_set *validation_data,
+        unsigned int *rows, unsigned int rowcount);
+int dt_prune_rows(decision_tree *dt, data_set *validation_data,
+        unsigned int *rows, unsigned int rowcount);
+
+// the score used to pick split columns, computed from the class histograms of
+// the rows on each side of a split. higher is better. parent_impurity is the
+// entropy of the unsplit rows and is ignored for CR_GINI
+float dt_split_gain(split_criterion criterion, float parent_impurity,
+        const float *lesser, const float *greater, int classcount);
+
 // attempt to prune the decision tree to improve classification accuracy on the
 // validation data. this function is not automatically called, and may run for
 // a long time
 // returns the number of nodes pruned
 int dt_prune(decision_tree *dt, data_set *validation_data);
 
+// one tree in the minimal cost-complexity pruning sequence
+typedef struct dt_ccp_step {
+    // the smallest alpha for which this tree is the optimal subtree
+    float alpha;
+    int leaves;
+    int nodes;
+    // training rows misclassified by this tree
+    float train_error;
+} dt_ccp_step;
+
+typedef struct dt_ccp_path {
+    int count;
+    // the full tree first, then every smaller tree in order of increasing
+    // alpha, down to the root alone
+    dt_ccp_step *steps;
+} dt_ccp_path;
+
+// compute the CART minimal cost-complexity pruning path of a trained tree
+// the cost of a subtree is its training error plus alpha for every leaf.
+// one bottom-up pass over the stored per-node training errors finds the
+// alpha at which every node collapses (stored in dt_node.prune_alpha) and the
+// whole nested sequence of pruned trees. nothing is re-scored or retrained
+// free the result with dt_ccp_free
+dt_ccp_path* dt_ccp_compute(decision_tree *dt);
+void dt_ccp_free(dt_ccp_path *path);
+
+// prune to the optimal subtree for alpha in a single pass over the tree
+// requires dt_ccp_compute to have been called on the current tree
+// returns the number of nodes pruned
+int dt_prune_alpha(decision_tree *dt, float alpha);
+
+// prune to the largest tree on the path with at most max_nodes nodes
+// returns the number of nodes pruned
+int dt_prune_to_size(decision_tree *dt, dt_ccp_path *path, int max_nodes);
+
+// one tree in the sequence made by dt_prune_to_budget
+typedef struct dt_budget_step {
+    int nodes;
+    // dt_score of the tree on the validation data
+    float score;
+} dt_budget_step;
 
+typedef struct dt_budget_curve {
+    int count;
+    // the unpruned tree first, then the tree after every collapse
+    dt_budget_step *steps;
+} dt_budget_curve;
 
+// prune until the tree has at most max_nodes nodes (use sizeof(ft_node) to
+// turn a byte budget into nodes), giving up as little validation accuracy as
+// possible: every step collapses the subtree that loses the least accuracy
+// per node removed, which may also be a subtree whose collapse gains
+// accuracy. validation_data REQUIRES y data
+// returns the size and score after every step, free it with dt_budget_free
+dt_budget_curve* dt_prune_to_budget(decision_tree *dt, data_set *validation_data, size_t max_nodes);
+void dt_budget_free(dt_budget_curve *curve);
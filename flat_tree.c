@@ -0,0 +1,698 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "flat_tree.h"
+
+#define FT_MAGIC "DTFT"
+#define FT_VERSION 3
+// written after the nodes when the model has a profile
+#define FT_PROFILE_MAGIC "PROF"
+// written after the nodes (and profile) when the model has categorical
+// splits, which need version 3
+#define FT_SETS_MAGIC "CATS"
+
+// rows routed together by ft_predict_blocked: enough that the lower levels
+// of big trees still see several rows per node, few enough that their
+// features stay in the last level cache
+#define FT_BLOCK_ROWS 65536
+// below this many rows at a node, ft_predict_blocked walks them one by one
+#define FT_BLOCK_MIN_ROWS 2
+
+// a node and the run of rows sitting at it, see ft_predict_blocked
+typedef struct ft_route {
+    unsigned int node;
+    unsigned int lo;
+    unsigned int hi;
+} ft_route;
+
+typedef struct ft_file_header {
+    char magic[4];
+    uint32_t version;
+    uint32_t nodecount;
+    uint32_t colcount;
+} ft_file_header;
+
+int ft_emit_node(flat_tree *ft, dt_node *node);
+int ft_check_nodes(flat_tree *ft);
+float ft_classify_strided(const flat_tree *ft, unsigned int i, const float *x, ptrdiff_t col_stride);
+int ft_lesser(const flat_tree *ft, unsigned int i, float value);
+void ft_children(flat_tree *ft, unsigned int i, unsigned int *lesser, unsigned int *greater);
+void ft_heap_push(unsigned int *heap, unsigned int *count, uint64_t *visits, unsigned int node);
+unsigned int ft_heap_pop(unsigned int *heap, unsigned int *count, uint64_t *visits);
+int ft_heap_before(uint64_t *visits, unsigned int a, unsigned int b);
+
+flat_tree* ft_new_from_tree(decision_tree *dt) {
+    flat_tree *ft = malloc(sizeof(flat_tree));
+    ft->nodecount = 0;
+    ft->colcount = 0;
+    ft->visits = NULL;
+    ft->sets = NULL;
+    ft->setwords = 0;
+
+    // single-child nodes get collapsed away, so this is an upper bound
+    int capacity = dt_node_count(dt);
+    if(capacity < 1) {
+        capacity = 1;
+    }
+    ft->nodes = malloc(capacity * sizeof(ft_node));
+    ft->set_start = calloc(capacity, sizeof(uint32_t));
+
+    if(ft_emit_node(ft, dt->root) != 0) {
+        ft_free(ft);
+        return NULL;
+    }
+
+    // give back the slots used by collapsed nodes
+    ft->nodes = realloc(ft->nodes, ft->nodecount * sizeof(ft_node));
+    if(ft->sets != NULL) {
+        ft->set_start = realloc(ft->set_start, ft->nodecount * sizeof(uint32_t));
+    }
+    else {
+        free(ft->set_start);
+        ft->set_start = NULL;
+    }
+    return ft;
+}
+
+void ft_free(flat_tree *ft) {
+    if(ft == NULL) {
+        return;
+    }
+    free(ft->nodes);
+    free(ft->visits);
+    free(ft->sets);
+    free(ft->set_start);
+    free(ft);
+}
+
+size_t ft_bytes(flat_tree *ft) {
+    size_t bytes = sizeof(flat_tree) + ft->nodecount * sizeof(ft_node);
+    if(ft->sets != NULL) {
+        bytes += (ft->setwords + ft->nodecount) * sizeof(uint32_t);
+    }
+    return bytes;
+}
+
+int ft_save(flat_tree *ft, char *filename) {
+    FILE *f = fopen(filename, "wb");
+    if(!f) {
+        fprintf(stderr, "Unable to open model file '%s' for writing\n", filename);
+        return -1;
+    }
+
+    ft_file_header header;
+    memcpy(header.magic, FT_MAGIC, 4);
+    // models without categorical splits stay readable by older versions
+    header.version = ft->sets != NULL ? FT_VERSION : 2;
+    header.nodecount = ft->nodecount;
+    header.colcount = ft->colcount;
+
+    int ok = fwrite(&header, sizeof(header), 1, f) == 1 &&
+        fwrite(ft->nodes, sizeof(ft_node), ft->nodecount, f) == ft->nodecount;
+    if(ok && ft->visits != NULL) {
+        ok = fwrite(FT_PROFILE_MAGIC, 4, 1, f) == 1 &&
+            fwrite(ft->visits, sizeof(uint64_t), ft->nodecount, f) == ft->nodecount;
+    }
+    if(ok && ft->sets != NULL) {
+        uint32_t setwords = ft->setwords;
+        ok = fwrite(FT_SETS_MAGIC, 4, 1, f) == 1 &&
+            fwrite(&setwords, sizeof(uint32_t), 1, f) == 1 &&
+            fwrite(ft->sets, sizeof(uint32_t), setwords, f) == setwords &&
+            fwrite(ft->set_start, sizeof(uint32_t), ft->nodecount, f) == ft->nodecount;
+    }
+    if(fclose(f) != 0) {
+        ok = 0;
+    }
+
+    if(!ok) {
+        fprintf(stderr, "Failed to write model file '%s'\n", filename);
+        return -1;
+    }
+    return 0;
+}
+
+flat_tree* ft_load(char *filename) {
+    FILE *f = fopen(filename, "rb");
+    if(!f) {
+        fprintf(stderr, "Unable to open model file '%s'\n", filename);
+        return NULL;
+    }
+
+    ft_file_header header;
+    if(fread(&header, sizeof(header), 1, f) != 1 ||
+            memcmp(header.magic, FT_MAGIC, 4) != 0) {
+        fprintf(stderr, "'%s' is not a decision tree model file\n", filename);
+        fclose(f);
+        return NULL;
+    }
+
+    // version 1 models are version 2 models without profiles or
+    // FT_NEAR_RIGHT nodes, and version 2 models are version 3 models without
+    // categorical splits
+    if(header.version < 1 || header.version > FT_VERSION || header.nodecount == 0) {
+        fprintf(stderr, "Unsupported model file '%s' (version %u, %u nodes)\n",
+                filename, header.version, header.nodecount);
+        fclose(f);
+        return NULL;
+    }
+
+    flat_tree *ft = malloc(sizeof(flat_tree));
+    ft->nodecount = header.nodecount;
+    ft->colcount = header.colcount;
+    ft->visits = NULL;
+    ft->sets = NULL;
+    ft->setwords = 0;
+    ft->set_start = NULL;
+    ft->nodes = malloc(ft->nodecount * sizeof(ft_node));
+    if(fread(ft->nodes, sizeof(ft_node), ft->nodecount, f) != ft->nodecount) {
+        fprintf(stderr, "Model file '%s' is truncated\n", filename);
+        ft_free(ft);
+        fclose(f);
+        return NULL;
+    }
+
+    // the profile and the category sets are optional, but anything else
+    // after the nodes is wrong
+    char magic[4];
+    size_t extra = fread(magic, 1, 4, f);
+    if(extra == 4 && memcmp(magic, FT_PROFILE_MAGIC, 4) == 0) {
+        ft->visits = malloc(ft->nodecount * sizeof(uint64_t));
+        if(fread(ft->visits, sizeof(uint64_t), ft->nodecount, f) != ft->nodecount) {
+            fprintf(stderr, "Model file '%s' has a corrupt profile\n", filename);
+            ft_free(ft);
+            fclose(f);
+            return NULL;
+        }
+        extra = fread(magic, 1, 4, f);
+    }
+    if(extra == 4 && memcmp(magic, FT_SETS_MAGIC, 4) == 0 && header.version >= 3) {
+        uint32_t setwords;
+        int ok = fread(&setwords, sizeof(uint32_t), 1, f) == 1;
+        if(ok) {
+            ft->setwords = setwords;
+            ft->sets = malloc((setwords + 1) * sizeof(uint32_t));
+            ft->set_start = malloc(ft->nodecount * sizeof(uint32_t));
+            ok = fread(ft->sets, sizeof(uint32_t), setwords, f) == setwords &&
+                fread(ft->set_start, sizeof(uint32_t), ft->nodecount, f) == ft->nodecount;
+        }
+        if(!ok) {
+            fprintf(stderr, "Model file '%s' has corrupt category sets\n", filename);
+            ft_free(ft);
+            fclose(f);
+            return NULL;
+        }
+        extra = fread(magic, 1, 4, f);
+    }
+    fclose(f);
+    if(extra > 0) {
+        fprintf(stderr, "Model file '%s' has unexpected data after the nodes\n", filename);
+        ft_free(ft);
+        return NULL;
+    }
+
+    // make sure a corrupt file can't send classification off the array
+    if(ft_check_nodes(ft) != 0) {
+        fprintf(stderr, "Model file '%s' is corrupt\n", filename);
+        ft_free(ft);
+        return NULL;
+    }
+
+    return ft;
+}
+
+// private function, returns 0 if the nodes form a single tree rooted at
+// node 0: every child index is in range, and every other node is the child
+// of exactly one node and can be reached from the root
+int ft_check_nodes(flat_tree *ft) {
+    unsigned int n = ft->nodecount;
+    unsigned char *parents = calloc(n, 1);
+    int ok = 1;
+
+    for(unsigned int i = 0; i < n && ok; i++) {
+        ft_node *node = &ft->nodes[i];
+        if(node->flags & ~(FT_LEAF | FT_NEAR_RIGHT | FT_CATEGORICAL)) {
+            ok = 0;
+        }
+        else if((node->flags & FT_CATEGORICAL) && !(node->flags & FT_LEAF)) {
+            // the set has to be inside of sets
+            unsigned long start = ft->sets != NULL ? ft->set_start[i] : 0;
+            ok = ft->sets != NULL && start < ft->setwords &&
+                ft->sets[start] <= DT_MAX_CATEGORIES &&
+                start + 1 + DT_CATEGORY_WORDS(ft->sets[start]) <= ft->setwords;
+        }
+        if(!ok || (node->flags & FT_LEAF)) {
+            continue;
+        }
+
+        if(i + 1 >= n || node->far >= n || node->far == i + 1 ||
+                node->split_col >= ft->colcount) {
+            ok = 0;
+        }
+        else {
+            parents[i + 1] += 1;
+            parents[node->far] += 1;
+            ok = parents[i + 1] == 1 && parents[node->far] == 1;
+        }
+    }
+    ok = ok && parents[0] == 0;
+    free(parents);
+    if(!ok) {
+        return -1;
+    }
+
+    // with one parent per node the only way to miss a node is a cycle that
+    // doesn't include the root, so walk the tree and count
+    unsigned int *stack = malloc(n * sizeof(unsigned int));
+    unsigned int depth = 1;
+    unsigned int reached = 0;
+    stack[0] = 0;
+    while(depth > 0) {
+        unsigned int i = stack[depth - 1];
+        depth -= 1;
+        reached += 1;
+        if(!(ft->nodes[i].flags & FT_LEAF)) {
+            stack[depth] = i + 1;
+            stack[depth + 1] = ft->nodes[i].far;
+            depth += 2;
+        }
+    }
+    free(stack);
+    return reached == n ? 0 : -1;
+}
+
+float ft_classify(const flat_tree *ft, const float *x) {
+    return ft_classify_strided(ft, 0, x, 1);
+}
+
+void ft_predict_strided(const flat_tree *ft, const float *x, size_t rowcount,
+        ptrdiff_t row_stride, ptrdiff_t col_stride, float *preds) {
+    for(size_t i = 0; i < rowcount; i++) {
+        preds[i] = ft_classify_strided(ft, 0, x + (ptrdiff_t)i * row_stride, col_stride);
+    }
+}
+
+void ft_predict_blocked(const flat_tree *ft, float **rows, size_t rowcount, float *preds) {
+    const ft_node *nodes = ft->nodes;
+    // the rows of a block, in the order they have been partitioned into
+    unsigned int *order = malloc(FT_BLOCK_ROWS * sizeof(unsigned int));
+    // nodes still to be visited and the run of order whose rows sit there.
+    // the runs never overlap and are never empty, so there can't be more of
+    // them than rows
+    ft_route *stack = malloc(FT_BLOCK_ROWS * sizeof(ft_route));
+
+    for(size_t start = 0; start < rowcount; start += FT_BLOCK_ROWS) {
+        unsigned int count = rowcount - start < FT_BLOCK_ROWS ? rowcount - start : FT_BLOCK_ROWS;
+        float **block = rows + start;
+        float *block_preds = preds + start;
+        for(unsigned int k = 0; k < count; k++) {
+            order[k] = k;
+        }
+
+        unsigned int top = 0;
+        stack[top].node = 0;
+        stack[top].lo = 0;
+        stack[top].hi = count;
+        top += 1;
+        while(top > 0) {
+            top -= 1;
+            unsigned int i = stack[top].node;
+            unsigned int lo = stack[top].lo;
+            unsigned int hi = stack[top].hi;
+
+            // follow the near children, leaving the far ones on the stack
+            while(1) {
+                if(nodes[i].flags & FT_LEAF) {
+                    for(unsigned int k = lo; k < hi; k++) {
+                        block_preds[order[k]] = nodes[i].value;
+                    }
+                    break;
+                }
+                if(hi - lo < FT_BLOCK_MIN_ROWS) {
+                    // too few rows left for partitioning to pay off
+                    for(unsigned int k = lo; k < hi; k++) {
+                        block_preds[order[k]] = ft_classify_strided(ft, i, block[order[k]], 1);
+                    }
+                    break;
+                }
+
+                // rows for the near child to the front, the far ones to the back
+                int near_right = (nodes[i].flags & FT_NEAR_RIGHT) != 0;
+                unsigned int col = nodes[i].split_col;
+                unsigned int mid = lo;
+                unsigned int end = hi;
+                while(mid < end) {
+                    if(ft_lesser(ft, i, block[order[mid]][col]) != near_right) {
+                        mid += 1;
+                    }
+                    else {
+                        end -= 1;
+                        unsigned int t = order[mid];
+                        order[mid] = order[end];
+                        order[end] = t;
+                    }
+                }
+
+                if(mid == lo) {
+                    i = nodes[i].far;
+                    continue;
+                }
+                if(mid < hi) {
+                    stack[top].node = nodes[i].far;
+                    stack[top].lo = mid;
+                    stack[top].hi = hi;
+                    top += 1;
+                }
+                i = i + 1;
+                hi = mid;
+            }
+        }
+    }
+
+    free(order);
+    free(stack);
+}
+
+// private function, classifies the row whose feature j is x[j * col_stride],
+// starting at node i
+float ft_classify_strided(const flat_tree *ft, unsigned int i, const float *x, ptrdiff_t col_stride) {
+    const ft_node *nodes = ft->nodes;
+    while(!(nodes[i].flags & FT_LEAF)) {
+        // the near child is the lesser one, unless FT_NEAR_RIGHT says otherwise
+        int lesser = ft_lesser(ft, i, x[nodes[i].split_col * col_stride]);
+        if(lesser != ((nodes[i].flags & FT_NEAR_RIGHT) != 0)) {
+            i = i + 1;
+        }
+        else {
+            i = nodes[i].far;
+        }
+    }
+    return nodes[i].value;
+}
+
+// private function, whether value goes to the lesser side of internal node i
+int ft_lesser(const flat_tree *ft, unsigned int i, float value) {
+    if(ft->nodes[i].flags & FT_CATEGORICAL) {
+        const uint32_t *set = ft->sets + ft->set_start[i];
+        return DT_IN_CATEGORIES(set + 1, set[0], value);
+    }
+    return value < ft->nodes[i].value;
+}
+
+float* ft_predict(flat_tree *ft, data_set *test_data) {
+    float *preds = malloc((test_data->rowcount + 1) * sizeof(float));
+    if(ft_bytes(ft) > FT_BLOCKED_MIN_BYTES) {
+        ft_predict_blocked(ft, test_data->x_data, test_data->rowcount, preds);
+        return preds;
+    }
+    for(int i = 0; i < test_data->rowcount; i++) {
+        preds[i] = ft_classify(ft, test_data->x_data[i]);
+    }
+    return preds;
+}
+
+void ft_profile(flat_tree *ft, data_set *data) {
+    if(ft->visits == NULL) {
+        ft->visits = calloc(ft->nodecount, sizeof(uint64_t));
+    }
+
+    ft_node *nodes = ft->nodes;
+    for(int row = 0; row < data->rowcount; row++) {
+        float *x = data->x_data[row];
+        unsigned int i = 0;
+        ft->visits[0] += 1;
+        while(!(nodes[i].flags & FT_LEAF)) {
+            int lesser = ft_lesser(ft, i, x[nodes[i].split_col]);
+            if(lesser != ((nodes[i].flags & FT_NEAR_RIGHT) != 0)) {
+                i = i + 1;
+            }
+            else {
+                i = nodes[i].far;
+            }
+            ft->visits[i] += 1;
+        }
+    }
+}
+
+void ft_reorder(flat_tree *ft) {
+    unsigned int n = ft->nodecount;
+    if(ft->visits == NULL) {
+        ft->visits = calloc(n, sizeof(uint64_t));
+    }
+
+    // order[k] is the old index of the node that goes to k
+    unsigned int *order = malloc(n * sizeof(unsigned int));
+    unsigned int *newidx = malloc(n * sizeof(unsigned int));
+    unsigned int *heap = malloc(n * sizeof(unsigned int));
+    unsigned int heapcount = 0;
+    unsigned int count = 0;
+
+    // pop the most visited run start, then follow the hot children from it
+    // down to a leaf. the cold children wait in the heap
+    ft_heap_push(heap, &heapcount, ft->visits, 0);
+    while(heapcount > 0) {
+        unsigned int i = ft_heap_pop(heap, &heapcount, ft->visits);
+        while(1) {
+            newidx[i] = count;
+            order[count] = i;
+            count += 1;
+            if(ft->nodes[i].flags & FT_LEAF) {
+                break;
+            }
+
+            unsigned int lesser, greater;
+            ft_children(ft, i, &lesser, &greater);
+            if(ft->visits[greater] > ft->visits[lesser]) {
+                ft_heap_push(heap, &heapcount, ft->visits, lesser);
+                i = greater;
+            }
+            else {
+                ft_heap_push(heap, &heapcount, ft->visits, greater);
+                i = lesser;
+            }
+        }
+    }
+
+    ft_node *nodes = malloc(n * sizeof(ft_node));
+    uint64_t *visits = malloc(n * sizeof(uint64_t));
+    uint32_t *set_start = ft->sets != NULL ? malloc(n * sizeof(uint32_t)) : NULL;
+    for(unsigned int k = 0; k < n; k++) {
+        unsigned int i = order[k];
+        nodes[k] = ft->nodes[i];
+        visits[k] = ft->visits[i];
+        if(set_start != NULL) {
+            set_start[k] = ft->set_start[i];
+        }
+        if(nodes[k].flags & FT_LEAF) {
+            continue;
+        }
+
+        // the hot child is always the next node of the run
+        unsigned int lesser, greater;
+        ft_children(ft, i, &lesser, &greater);
+        if(order[k + 1] == greater) {
+            nodes[k].flags |= FT_NEAR_RIGHT;
+            nodes[k].far = newidx[lesser];
+        }
+        else {
+            nodes[k].flags &= ~FT_NEAR_RIGHT;
+            nodes[k].far = newidx[greater];
+        }
+    }
+
+    free(ft->nodes);
+    free(ft->visits);
+    free(ft->set_start);
+    ft->nodes = nodes;
+    ft->visits = visits;
+    ft->set_start = set_start;
+    free(order);
+    free(newidx);
+    free(heap);
+}
+
+int ft_export_c(flat_tree *ft, char *filename, char *name) {
+    FILE *f = fopen(filename, "w");
+    if(!f) {
+        fprintf(stderr, "Unable to open '%s' for writing\n", filename);
+        return -1;
+    }
+
+    // only the far children are jumped to, everything else falls through
+    unsigned char *targets = calloc(ft->nodecount, 1);
+    for(unsigned int i = 0; i < ft->nodecount; i++) {
+        if(!(ft->nodes[i].flags & FT_LEAF)) {
+            targets[ft->nodes[i].far] = 1;
+        }
+    }
+
+    fprintf(f, "// decision tree with %u nodes, generated by dt_main\n\n", ft->nodecount);
+    if(ft->sets != NULL) {
+        // the category sets of the categorical splits, laid out like
+        // flat_tree.sets
+        fprintf(f, "#include <stdint.h>\n\n");
+        fprintf(f, "static const uint32_t %s_sets[%u] = {", name, ft->setwords);
+        for(unsigned int w = 0; w < ft->setwords; w++) {
+            fprintf(f, "%s0x%x,", w % 8 == 0 ? "\n    " : " ", ft->sets[w]);
+        }
+        fprintf(f, "\n};\n\n");
+        fprintf(f, "static int %s_in(float v, const uint32_t *set) {\n", name);
+        fprintf(f, "    return v >= 0 && v < set[0] &&\n");
+        fprintf(f, "        ((set[1 + (uint32_t)v / 32] >> ((uint32_t)v %% 32)) & 1);\n");
+        fprintf(f, "}\n\n");
+    }
+    if(ft->visits != NULL) {
+        fprintf(f, "#if defined(__GNUC__)\n");
+        fprintf(f, "#define DT_EXPECT(cond, likely) __builtin_expect(!!(cond), likely)\n");
+        fprintf(f, "#else\n");
+        fprintf(f, "#define DT_EXPECT(cond, likely) (cond)\n");
+        fprintf(f, "#endif\n\n");
+    }
+    fprintf(f, "float %s(const float *x) {\n", name);
+
+    for(unsigned int i = 0; i < ft->nodecount; i++) {
+        ft_node *node = &ft->nodes[i];
+        if(targets[i]) {
+            fprintf(f, "n%u:\n", i);
+        }
+        if(node->flags & FT_LEAF) {
+            // hex floats, so the values survive exactly
+            fprintf(f, "    return %af;\n", node->value);
+            continue;
+        }
+
+        // the condition for jumping to the far child
+        fprintf(f, "    if(");
+        if(ft->visits != NULL) {
+            fprintf(f, "DT_EXPECT(");
+        }
+        if(!(node->flags & FT_NEAR_RIGHT)) {
+            fprintf(f, "!(");
+        }
+        if(node->flags & FT_CATEGORICAL) {
+            fprintf(f, "%s_in(x[%u], %s_sets + %u)", name, node->split_col,
+                    name, ft->set_start[i]);
+        }
+        else {
+            fprintf(f, "x[%u] < %af", node->split_col, node->value);
+        }
+        if(!(node->flags & FT_NEAR_RIGHT)) {
+            fprintf(f, ")");
+        }
+        if(ft->visits != NULL) {
+            int likely = ft->visits[node->far] > ft->visits[i + 1];
+            fprintf(f, ", %d)", likely);
+        }
+        fprintf(f, ") goto n%u;\n", node->far);
+    }
+    fprintf(f, "}\n");
+    free(targets);
+
+    if(fclose(f) != 0) {
+        fprintf(stderr, "Failed to write '%s'\n", filename);
+        return -1;
+    }
+    return 0;
+}
+
+// private function, the old indices of the children of internal node i
+void ft_children(flat_tree *ft, unsigned int i, unsigned int *lesser, unsigned int *greater) {
+    if(ft->nodes[i].flags & FT_NEAR_RIGHT) {
+        *lesser = ft->nodes[i].far;
+        *greater = i + 1;
+    }
+    else {
+        *lesser = i + 1;
+        *greater = ft->nodes[i].far;
+    }
+}
+
+// private functions, a binary max-heap of node indices ordered by visits
+// (ties go to the lower index, so the layout is deterministic)
+int ft_heap_before(uint64_t *visits, unsigned int a, unsigned int b) {
+    return visits[a] > visits[b] || (visits[a] == visits[b] && a < b);
+}
+
+void ft_heap_push(unsigned int *heap, unsigned int *count, uint64_t *visits, unsigned int node) {
+    unsigned int i = *count;
+    *count += 1;
+    while(i > 0 && ft_heap_before(visits, node, heap[(i - 1) / 2])) {
+        heap[i] = heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    heap[i] = node;
+}
+
+unsigned int ft_heap_pop(unsigned int *heap, unsigned int *count, uint64_t *visits) {
+    unsigned int top = heap[0];
+    *count -= 1;
+    unsigned int last = heap[*count];
+    unsigned int i = 0;
+    while(2 * i + 1 < *count) {
+        unsigned int child = 2 * i + 1;
+        if(child + 1 < *count && ft_heap_before(visits, heap[child + 1], heap[child])) {
+            child += 1;
+        }
+        if(!ft_heap_before(visits, heap[child], last)) {
+            break;
+        }
+        heap[i] = heap[child];
+        i = child;
+    }
+    heap[i] = last;
+    return top;
+}
+
+// private function, appends `node` and its subtree to the node array in
+// preorder. mirrors the traversal rules of dt_classify: a node with only one
+// child always ends up at that child, so it is replaced by the child, and a
+// non-leaf node with no children classifies as 2
+// returns 0 on success
+int ft_emit_node(flat_tree *ft, dt_node *node) {
+    while(!node->is_leaf && (node->left == NULL) != (node->right == NULL)) {
+        node = node->left != NULL ? node->left : node->right;
+    }
+
+    unsigned int idx = ft->nodecount;
+    ft_node *fn = &ft->nodes[idx];
+    ft->nodecount += 1;
+
+    if(node->is_leaf || node->left == NULL) {
+        fn->value = node->is_leaf ? node->prediction_value : 2;
+        fn->far = 0;
+        fn->split_col = 0;
+        fn->flags = FT_LEAF;
+        return 0;
+    }
+
+    if(node->split_col > UINT16_MAX) {
+        fprintf(stderr, "Can't flatten a split on column %u, the limit is %u\n",
+                node->split_col, UINT16_MAX);
+        return -1;
+    }
+
+    fn->value = node->split_value;
+    fn->split_col = node->split_col;
+    fn->flags = 0;
+    if(node->categories != NULL) {
+        // the set goes at the end of sets, behind its category count
+        unsigned int words = DT_CATEGORY_WORDS(node->category_count);
+        ft->sets = realloc(ft->sets, (ft->setwords + 1 + words) * sizeof(uint32_t));
+        ft->set_start[idx] = ft->setwords;
+        ft->sets[ft->setwords] = node->category_count;
+        memcpy(ft->sets + ft->setwords + 1, node->categories, words * sizeof(uint32_t));
+        ft->setwords += 1 + words;
+        fn->value = 0;
+        fn->flags = FT_CATEGORICAL;
+    }
+    if(node->split_col + 1 > ft->colcount) {
+        ft->colcount = node->split_col + 1;
+    }
+
+    if(ft_emit_node(ft, node->left) != 0) {
+        return -1;
+    }
+
+    // the right subtree starts right after the whole left subtree
+    ft->nodes[idx].far = ft->nodecount;
+    return ft_emit_node(ft, node->right);
+}
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "data_set.h"
+#include "decision_tree.h"
+
+// node flags
+#define FT_LEAF 0x1
+// the right (>= value) child is the one at i+1, and far is the left child
+#define FT_NEAR_RIGHT 0x2
+// a categorical split, see flat_tree.sets
+#define FT_CATEGORICAL 0x4
+
+// compact 12 byte node used for inference on trained trees
+// one child of an internal node always sits directly after it in the node
+// array, so only the index of the other (far) child needs to be stored.
+// ft_new_from_tree stores nodes in preorder, with the left child next
+typedef struct ft_node {
+    // split threshold for numeric splits, predicted class for leaves
+    float value;
+    // index of the child that isn't at i+1 (unused for leaves)
+    uint32_t far;
+    uint16_t split_col;
+    uint16_t flags;
+} ft_node;
+
+typedef struct flat_tree {
+    unsigned int nodecount;
+    // one more than the highest column used by a split
+    unsigned int colcount;
+    ft_node *nodes;
+    // how many profiled rows reached each node, NULL if not profiled
+    uint64_t *visits;
+    // the category bitsets of categorical splits, NULL if there are none.
+    // a FT_CATEGORICAL node i sends the categories in the set at
+    // sets + set_start[i] to its lesser side: the first word is the number
+    // of categories, and the bits (see DT_IN_CATEGORIES) follow
+    uint32_t *sets;
+    unsigned int setwords;
+    uint32_t *set_start;
+} flat_tree;
+
+// build a flattened copy of a trained decision tree
+// the decision tree is not modified and can be freed afterwards
+// returns NULL if the tree splits on a column that doesn't fit in 16 bits
+flat_tree* ft_new_from_tree(decision_tree *dt);
+
+// free all memory associated with the flat tree
+void ft_free(flat_tree *ft);
+
+// the number of bytes used by the flat tree, including the header
+size_t ft_bytes(flat_tree *ft);
+
+// write the flat tree to a binary model file, returns 0 on success
+// the format is native endian, so models are not portable between machines
+// with different byte orders. the profile is saved too, if there is one
+int ft_save(flat_tree *ft, char *filename);
+
+// load a model written by ft_save, returns NULL on failure
+flat_tree* ft_load(char *filename);
+
+// classify a single row of `colcount` floats
+// allocation-free and read-only, so any number of threads can share the tree
+float ft_classify(const flat_tree *ft, const float *x);
+
+// same as dt_predict_strided: column j of row i is
+// x[i * row_stride + j * col_stride], and preds must hold rowcount floats
+void ft_predict_strided(const flat_tree *ft, const float *x, size_t rowcount,
+        ptrdiff_t row_stride, ptrdiff_t col_stride, float *preds);
+
+// trees bigger than this (in ft_bytes) are faster to route with
+// ft_predict_blocked than a row at a time
+#define FT_BLOCKED_MIN_BYTES (4 << 20)
+
+// classify rowcount rows given as pointers to their features (like
+// data_set.x_data) for trees much bigger than the cache. instead of walking
+// the tree once per row, which fetches the top nodes over and over and
+// misses on the rest, the rows are routed a block at a time: all of a
+// block's rows start at the root, and the rows at each node are partitioned
+// between its children before moving on. the nodes are visited depth first,
+// so every node is fetched at most once per block, in array order for trees
+// laid out by ft_new_from_tree, and the block's features stay in cache.
+// preds must hold rowcount floats. thread-safe like ft_predict_strided, but
+// allocates a little scratch space
+void ft_predict_blocked(const flat_tree *ft, float **rows, size_t rowcount, float *preds);
+
+// same as dt_predict, the returned array should be freed after use
+// trees bigger than FT_BLOCKED_MIN_BYTES are routed with ft_predict_blocked
+float* ft_predict(flat_tree *ft, data_set *test_data);
+
+// run every row of data through the tree and add up how many rows reach each
+// node in ft->visits (the traversal count of the edge into the node)
+void ft_profile(flat_tree *ft, data_set *data);
+
+// lay the nodes out again using the profile: starting at the root, every
+// node is followed by its more visited child, so the hottest root-to-leaf
+// path is one contiguous run of nodes at the front of the array. the cold
+// children start new runs, placed in order of how many rows reach them.
+// predictions don't change
+void ft_reorder(flat_tree *ft);
+
+// write the tree as a C function `float name(const float *x)`, one label per
+// node in array order, so the next node is reached by falling through. if
+// the tree has a profile, every split gets a __builtin_expect hint for its
+// more visited side. returns 0 on success
+int ft_export_c(flat_tree *ft, char *filename, char *name);
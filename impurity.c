@@ -0,0 +1,143 @@
+#include <math.h>
+#include <pthread.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "impurity.h"
+
+// n * log2(n) for the whole numbers below IMP_TABLE_SIZE, filled in once by
+// the first kernel that needs it
+double imp_table[IMP_TABLE_SIZE];
+pthread_once_t imp_table_once = PTHREAD_ONCE_INIT;
+
+void imp_fill_table(void);
+double imp_lookup(double n);
+void imp_sums(const float *counts, int classcount, double *total, double *squares);
+
+double imp_nlogn(float n) {
+    pthread_once(&imp_table_once, imp_fill_table);
+    return imp_lookup(n);
+}
+
+float imp_entropy(const float *counts, int classcount, float total) {
+    if(total <= 0) {
+        return 0.0;
+    }
+    imp_side side;
+    imp_side_entropy(&side, counts, classcount);
+    double entropy = (imp_lookup(total) - side.sum) / total;
+    // rounding can take a pure histogram just below 0
+    return entropy > 0 ? entropy : 0.0;
+}
+
+float imp_gini(const float *counts, int classcount, float total) {
+    if(total <= 0) {
+        return 0.0;
+    }
+    double sum;
+    double squares;
+    imp_sums(counts, classcount, &sum, &squares);
+    return squares / ((double)total * total);
+}
+
+void imp_side_gini(imp_side *side, const float *counts, int classcount) {
+    imp_sums(counts, classcount, &side->total, &side->sum);
+}
+
+void imp_side_entropy(imp_side *side, const float *counts, int classcount) {
+    pthread_once(&imp_table_once, imp_fill_table);
+    side->total = 0;
+    side->sum = 0;
+    for(int c = 0; c < classcount; c++) {
+        side->total += counts[c];
+        side->sum += imp_lookup(counts[c]);
+    }
+}
+
+void imp_move_gini(imp_side *from, imp_side *to, float from_count, float to_count, float weight) {
+    from->total -= weight;
+    to->total += weight;
+    // (c - w)^2 - c^2 and (c + w)^2 - c^2
+    from->sum += (double)weight * weight - 2.0 * from_count * weight;
+    to->sum += (double)weight * weight + 2.0 * to_count * weight;
+}
+
+void imp_move_entropy(imp_side *from, imp_side *to, float from_count, float to_count, float weight) {
+    pthread_once(&imp_table_once, imp_fill_table);
+    from->total -= weight;
+    to->total += weight;
+    from->sum += imp_lookup((double)from_count - weight) - imp_lookup(from_count);
+    to->sum += imp_lookup((double)to_count + weight) - imp_lookup(to_count);
+}
+
+float imp_gini_score(const imp_side *lesser, const imp_side *greater) {
+    double score = 0;
+    if(lesser->total > 0) {
+        score += lesser->sum / lesser->total;
+    }
+    if(greater->total > 0) {
+        score += greater->sum / greater->total;
+    }
+    return score / (lesser->total + greater->total);
+}
+
+float imp_entropy_gain(float parent_entropy, const imp_side *lesser, const imp_side *greater) {
+    pthread_once(&imp_table_once, imp_fill_table);
+    // total * entropy of each side, which is nlogn(total) - sum
+    double lesser_part = lesser->total > 0 ? imp_lookup(lesser->total) - lesser->sum : 0;
+    double greater_part = greater->total > 0 ? imp_lookup(greater->total) - greater->sum : 0;
+    return parent_entropy - (lesser_part + greater_part) / (lesser->total + greater->total);
+}
+
+// private function, the pthread_once routine that fills imp_table
+void imp_fill_table(void) {
+    imp_table[0] = 0;
+    for(int n = 1; n < IMP_TABLE_SIZE; n++) {
+        imp_table[n] = n * log2(n);
+    }
+}
+
+// private function, n * log2(n) once the table has been filled
+double imp_lookup(double n) {
+    if(n <= 0) {
+        return 0;
+    }
+    if(n < IMP_TABLE_SIZE && n == (int)n) {
+        return imp_table[(int)n];
+    }
+    return n * log2(n);
+}
+
+// private function, the sum of the counts and of their squares
+void imp_sums(const float *counts, int classcount, double *total, double *squares) {
+    int c = 0;
+    double sum = 0;
+    double sumsq = 0;
+#ifdef __SSE2__
+    // two doubles per register, so four counts per step make two registers
+    __m128d sum_lo = _mm_setzero_pd();
+    __m128d sum_hi = _mm_setzero_pd();
+    __m128d sq_lo = _mm_setzero_pd();
+    __m128d sq_hi = _mm_setzero_pd();
+    for(; c + 4 <= classcount; c += 4) {
+        __m128 v = _mm_loadu_ps(counts + c);
+        __m128d lo = _mm_cvtps_pd(v);
+        __m128d hi = _mm_cvtps_pd(_mm_movehl_ps(v, v));
+        sum_lo = _mm_add_pd(sum_lo, lo);
+        sum_hi = _mm_add_pd(sum_hi, hi);
+        sq_lo = _mm_add_pd(sq_lo, _mm_mul_pd(lo, lo));
+        sq_hi = _mm_add_pd(sq_hi, _mm_mul_pd(hi, hi));
+    }
+    double lanes[2];
+    _mm_storeu_pd(lanes, _mm_add_pd(sum_lo, sum_hi));
+    sum = lanes[0] + lanes[1];
+    _mm_storeu_pd(lanes, _mm_add_pd(sq_lo, sq_hi));
+    sumsq = lanes[0] + lanes[1];
+#endif
+    for(; c < classcount; c++) {
+        sum += counts[c];
+        sumsq += (double)counts[c] * counts[c];
+    }
+    *total = sum;
+    *squares = sumsq;
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+// impurity kernels for split scoring, working on class histograms (counts
+// of each class, weighted by the sample weights)
+// entropy is computed as log2(t) - sum(c * log2(c)) / t over the counts c
+// with total t, and c * log2(c) is looked up in a table for whole counts
+// below IMP_TABLE_SIZE, so the usual unweighted (or deduplicated) rows need
+// no logarithms at all. the sums are vectorized with SSE2 where available
+#define IMP_TABLE_SIZE 4096
+
+// n * log2(n), 0 for n = 0
+double imp_nlogn(float n);
+
+// entropy (in bits) and gini (sum of squared class shares) of a histogram
+// whose counts add up to total, 0 if total isn't positive
+float imp_entropy(const float *counts, int classcount, float total);
+float imp_gini(const float *counts, int classcount, float total);
+
+// one side of a split, in a form that can be updated as rows move between
+// the sides: the total weight, and the sum over the classes of c * c for
+// gini or c * log2(c) for entropy
+typedef struct imp_side {
+    double total;
+    double sum;
+} imp_side;
+
+// the side holding the histogram counts
+void imp_side_gini(imp_side *side, const float *counts, int classcount);
+void imp_side_entropy(imp_side *side, const float *counts, int classcount);
+
+// weight of a class moves from one side to the other. from_count and
+// to_count are that class's counts on the two sides before the move
+void imp_move_gini(imp_side *from, imp_side *to, float from_count, float to_count, float weight);
+void imp_move_entropy(imp_side *from, imp_side *to, float from_count, float to_count, float weight);
+
+// the split scores of dt_split_gain, from the two sides: the weighted mean
+// gini of the sides, and the information gain over parent_entropy
+float imp_gini_score(const imp_side *lesser, const imp_side *greater);
+float imp_entropy_gain(float parent_entropy, const imp_side *lesser, const imp_side *greater);
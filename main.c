@@ -1,121 +1,272 @@
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
 #include <string.h>
 #include "csv.h"
+#include "cross_validate.h"
 #include "data_set.h"
 #include "decision_tree.h"
+#include "flat_tree.h"
+#include "server.h"
+#include "sparse_set.h"
+#include "sweep.h"
+#include "writer.h"
 
-int main(int argc, char *argv[]) {
-    printf("Decision tree!\n");
-
-    if(argc != 7) {
-        fprintf(stderr, "Usage: %s [entropy|gini] [prune|noprune] <train csv> <valiate csv> <test csv> <prediction file>\n", argv[0]);
-        return 1;
-    }
-
-    char *split_metric = argv[1];
-    split_criterion criterion;
-    char *prune_str = argv[2];
-    int do_prune;
-    csv_file *train_csv = csv_new(argv[3]);
-    csv_file *validate_csv = csv_new(argv[4]);
-    csv_file *test_csv = csv_new(argv[5]);
-    FILE *prediction_file = fopen(argv[6], "w");
-
+int parse_criterion(char *split_metric, split_criterion *criterion) {
     if(strcmp(split_metric, "entropy") == 0) {
         printf("Using entropy metric for splits\n");
-        criterion = CR_ENTROPY;
+        *criterion = CR_ENTROPY;
     }
     else if(strcmp(split_metric, "gini") == 0) {
         printf("Using Gini (population diversity) metric for splits\n");
-        criterion = CR_GINI;
+        *criterion = CR_GINI;
     }
     else {
         fprintf(stderr, "Unknown split metric: %s\n", split_metric);
         fprintf(stderr, "Use either 'entropy' or 'gini'\n");
-        return 1;
+        return -1;
+    }
+    return 0;
+}
+
+// how the tree gets pruned after training
+#define PRUNE_NONE 0
+#define PRUNE_GREEDY 1
+#define PRUNE_CCP 2
+#define PRUNE_BUDGET 3
+
+typedef struct prune_options {
+    int mode;
+    // for PRUNE_CCP and PRUNE_BUDGET
+    int max_nodes;
+} prune_options;
+
+// a node count, or a byte count of the flattened tree with a B, KB or MB
+// suffix. returns 0 if the budget can't be parsed
+int parse_budget(char *budget_str) {
+    char *end;
+    long value = strtol(budget_str, &end, 10);
+    if(end == budget_str || value <= 0) {
+        return 0;
+    }
+    if(*end == '\0') {
+        return value;
     }
 
+    long bytes;
+    if(strcmp(end, "B") == 0) {
+        bytes = value;
+    }
+    else if(strcmp(end, "KB") == 0) {
+        bytes = value * 1024;
+    }
+    else if(strcmp(end, "MB") == 0) {
+        bytes = value * 1024 * 1024;
+    }
+    else {
+        return 0;
+    }
+    long nodes = (bytes - (long)sizeof(flat_tree)) / (long)sizeof(ft_node);
+    return nodes > 0 ? nodes : 0;
+}
+
+int parse_prune(char *prune_str, prune_options *prune) {
     if(strcmp(prune_str, "prune") == 0) {
-        do_prune = 1;
+        prune->mode = PRUNE_GREEDY;
     }
     else if(strcmp(prune_str, "noprune") == 0) {
-        do_prune = 0;
+        prune->mode = PRUNE_NONE;
+    }
+    else if(strncmp(prune_str, "ccp=", 4) == 0 && atoi(prune_str + 4) > 0) {
+        prune->mode = PRUNE_CCP;
+        prune->max_nodes = atoi(prune_str + 4);
+    }
+    else if(strncmp(prune_str, "budget=", 7) == 0 && parse_budget(prune_str + 7) > 0) {
+        prune->mode = PRUNE_BUDGET;
+        prune->max_nodes = parse_budget(prune_str + 7);
     }
     else {
         fprintf(stderr, "Unknown prune directive: %s\n", prune_str);
-        fprintf(stderr, "Use either 'prune' or 'noprune'\n");
-        return 1;
+        fprintf(stderr, "Use 'prune', 'noprune', 'ccp=<max nodes>' or "
+                "'budget=<max nodes|max size>' (size as e.g. 256KB)\n");
+        return -1;
     }
+    return 0;
+}
 
-    if(train_csv == NULL) {
-        fprintf(stderr, "Failed to open training CSV file\n");
-        return 1;
+void print_data_set_info(char *name, data_set *ds) {
+    if(ds->has_ydata) {
+        printf("%s data set has %d rows, %d columns, HAS y data\n",
+            name, ds->rowcount, ds->colcount);
     }
-
-    if(validate_csv == NULL) {
-        fprintf(stderr, "Failed to open validation CSV file\n");
-        return 1;
+    else {
+        printf("%s data set has %d rows, %d columns, DOES NOT HAVE y data\n",
+            name, ds->rowcount, ds->colcount);
     }
+}
 
-    if(test_csv == NULL) {
-        fprintf(stderr, "Failed to open test CSV file\n");
-        return 1;
-    }
+// the number of test rows predicted before they are handed to the writer
+#define PREDICTION_CHUNK 65536
 
-    if(prediction_file == NULL) {
-        fprintf(stderr, "Failed to open prediction output file!\n");
-        return 1;
+// set by --dedup, collapse duplicate training rows into weighted rows
+int dedup_training = 0;
+// set by --sample=RATE, see decision_tree.sample_rate
+float sample_rate = 0;
+// set by --levelwise, train with dt_train_levelwise
+int levelwise = 0;
+// set by --workers=N, train with dt_train_distributed on N worker processes
+int workers = 0;
+// set by --raw-predictions, write predictions as WR_RAW instead of csv
+int raw_predictions = 0;
+// set by --libsvm, read libsvm files and train with dt_train_sparse
+int libsvm_input = 0;
+// set by --categorical=COLS, a comma separated list of the (0 based) columns
+// that hold category codes
+char *categorical_columns = NULL;
+
+// declares the --categorical columns of ds categorical
+// returns -1 if the list isn't made of columns of ds
+int mark_categorical(data_set *ds) {
+    char *list = categorical_columns;
+    while(list != NULL && *list != '\0') {
+        char *end;
+        long col = strtol(list, &end, 10);
+        if(end == list || col < 0 || (*end != ',' && *end != '\0')) {
+            fprintf(stderr, "Bad categorical column list: %s\n", categorical_columns);
+            return -1;
+        }
+        if(ds_set_categorical(ds, col) != 0) {
+            return -1;
+        }
+        list = *end == ',' ? end + 1 : end;
     }
+    return 0;
+}
 
+// returns the training set in train_csv, deduplicated if requested, or NULL
+// if the categorical columns don't fit it
+data_set* load_training_set(csv_file *train_csv) {
     data_set *train_ds = ds_create_from_csv(train_csv, 1);
-    csv_free(train_csv);
-
-    data_set *validate_ds = ds_create_from_csv(validate_csv, 1);
-    csv_free(validate_csv);
-
-    // 0 in the last arg means no y data
-    data_set *test_ds = ds_create_from_csv(test_csv, 0);
-    csv_free(test_csv);
-
-    if(train_ds->has_ydata) {
-        printf("Training data set has %d rows, %d columns, HAS y data\n",
-            train_ds->rowcount, train_ds->colcount);
+    if(mark_categorical(train_ds) != 0) {
+        ds_free(train_ds);
+        return NULL;
     }
-    else {
-        printf("Training data set has %d rows, %d columns, DOES NOT HAVE y data\n", train_ds->rowcount, train_ds->colcount);
+    if(dedup_training) {
+        unsigned int before = train_ds->rowcount;
+        ds_dedup(train_ds);
+        printf("Collapsed %u training rows into %u weighted rows\n",
+                before, train_ds->rowcount);
     }
+    return train_ds;
+}
 
-    if(validate_ds->has_ydata) {
-        printf("Validation data set has %d rows, %d columns, HAS y data\n", validate_ds->rowcount, validate_ds->colcount);
-    }
-    else {
-        printf("Validation data set has %d rows, %d columns, DOES NOT HAVE y data\n", validate_ds->rowcount, validate_ds->colcount);
-    }
+// loads a CSV file into a data set on a thread of its own, so that files
+// that aren't needed yet can load while the tree trains
+typedef struct csv_loader {
+    char *filename;
+    int has_y;
+    // NULL if the file couldn't be read
+    data_set *ds;
+    pthread_t thread;
+} csv_loader;
 
-    if(test_ds->has_ydata) {
-        printf("Test data set has %d rows, %d columns, HAS y data\n", test_ds->rowcount, test_ds->colcount);
-    }
-    else {
-        printf("Test data set has %d rows, %d columns, DOES NOT HAVE y data\n", test_ds->rowcount, test_ds->colcount);
+void* csv_loader_thread(void *arg) {
+    csv_loader *loader = arg;
+    csv_file *csv = csv_new_list(loader->filename, 0);
+    loader->ds = NULL;
+    if(csv != NULL) {
+        loader->ds = ds_create_from_csv(csv, loader->has_y);
+        csv_free(csv);
     }
+    return NULL;
+}
+
+void csv_loader_start(csv_loader *loader, char *filename, int has_y) {
+    loader->filename = filename;
+    loader->has_y = has_y;
+    pthread_create(&loader->thread, NULL, csv_loader_thread, loader);
+}
 
+// wait for the file to be loaded, returns loader->ds
+data_set* csv_loader_finish(csv_loader *loader) {
+    pthread_join(loader->thread, NULL);
+    return loader->ds;
+}
+
+// train a tree on train_ds, then score it on the validation set and prune it
+// if requested. the validation set is only waited for once training is done
+// returns NULL if training failed or the validation set couldn't be loaded
+decision_tree* train_and_prune(split_criterion criterion, prune_options *prune,
+        data_set *train_ds, csv_loader *validate) {
     decision_tree *dt = dt_new(0, criterion);
+    dt->sample_rate = sample_rate;
 
     printf("Training decision tree on training data set...\n");
-    if(dt_train(dt, train_ds) == 0) {
-        printf("Training successful\n");
+    int trained = workers > 0 ? dt_train_distributed(dt, train_ds, workers) :
+        levelwise ? dt_train_levelwise(dt, train_ds) : dt_train(dt, train_ds);
+    if(trained != 0) {
+        // e.g. a worker died, what was built of the tree is of no use
+        fprintf(stderr, "Training failed\n");
+        dt_free(dt);
+        data_set *validate_ds = csv_loader_finish(validate);
+        if(validate_ds != NULL) {
+            ds_free(validate_ds);
+        }
+        return NULL;
     }
-    else {
-        printf("Training failed?\n");
+    printf("Training successful\n");
+
+    data_set *validate_ds = csv_loader_finish(validate);
+    if(validate_ds == NULL) {
+        fprintf(stderr, "Failed to open validation CSV file\n");
+        dt_free(dt);
+        return NULL;
     }
+    print_data_set_info("Validation", validate_ds);
 
     printf("Scoring validation data set\n");
     float score = dt_score(dt, validate_ds);
     printf("Score: %.4f\n", score);
 
-    if(do_prune) {
+    if(prune->mode == PRUNE_CCP) {
+        int precount = dt_node_count(dt);
+
+        printf("Computing the cost-complexity pruning path\n");
+        dt_ccp_path *path = dt_ccp_compute(dt);
+        printf("Path has %d subtrees, from %d down to %d nodes\n", path->count,
+                path->steps[0].nodes, path->steps[path->count - 1].nodes);
+
+        int pruned = dt_prune_to_size(dt, path, prune->max_nodes);
+        printf("Pruned %d nodes to fit in %d nodes\n", pruned, prune->max_nodes);
+        dt_ccp_free(path);
+
+        float prune_score = dt_score(dt, validate_ds);
+        printf("New score: %.4f\n", prune_score);
+        printf("Improvement of %.3f\n", prune_score - score);
+        printf("Removed %.3f%% of the tree\n", (((float)pruned)/precount)*100);
+    }
+    else if(prune->mode == PRUNE_BUDGET) {
+        printf("Pruning to at most %d nodes (%lu bytes flattened)\n", prune->max_nodes,
+                (unsigned long)(sizeof(flat_tree) + prune->max_nodes * sizeof(ft_node)));
+        dt_budget_curve *curve = dt_prune_to_budget(dt, validate_ds, prune->max_nodes);
+
+        // the whole curve can be thousands of steps, print about 20 of them
+        printf("   nodes   score\n");
+        int every = curve->count / 20 + 1;
+        for(int i = 0; i < curve->count; i++) {
+            if(i % every == 0 || i == curve->count - 1) {
+                printf("%8d  %.4f\n", curve->steps[i].nodes, curve->steps[i].score);
+            }
+        }
+
+        dt_budget_step *last = &curve->steps[curve->count - 1];
+        printf("Pruned %d nodes, %d left\n", curve->steps[0].nodes - last->nodes, last->nodes);
+        printf("New score: %.4f\n", last->score);
+        printf("Improvement of %.3f\n", last->score - score);
+        dt_budget_free(curve);
+    }
+    else if(prune->mode == PRUNE_GREEDY) {
         int precount = dt_node_count(dt);
 
         printf("Attempting to prune the tree. This may take a while...\n");
@@ -135,22 +286,562 @@ int main(int argc, char *argv[]) {
         }
     }
 
-    printf("Running predictions for test data\n");
-    float *preds = dt_predict(dt, test_ds);
+    return dt;
+}
+
+// dt_main train [entropy|gini] [prune|noprune|ccp=N|budget=N] <train csv> <validate csv> <model file>
+int train_main(int argc, char *argv[]) {
+    if(argc != 7) {
+        fprintf(stderr, "Usage: %s train [entropy|gini] [prune|noprune|ccp=N|budget=N] <train csv> <validate csv> <model file>\n", argv[0]);
+        return 1;
+    }
+
+    split_criterion criterion;
+    prune_options prune;
+    if(parse_criterion(argv[2], &criterion) != 0 || parse_prune(argv[3], &prune) != 0) {
+        return 1;
+    }
+
+    // the validation set loads while the tree trains
+    csv_loader validate;
+    csv_loader_start(&validate, argv[5], 1);
+
+    csv_file *train_csv = csv_new_list(argv[4], 0);
+    if(train_csv == NULL) {
+        fprintf(stderr, "Failed to open training CSV file\n");
+        return 1;
+    }
+    data_set *train_ds = load_training_set(train_csv);
+    csv_free(train_csv);
+    if(train_ds == NULL) {
+        return 1;
+    }
+    print_data_set_info("Training", train_ds);
+
+    decision_tree *dt = train_and_prune(criterion, &prune, train_ds, &validate);
+    if(dt == NULL) {
+        return 1;
+    }
+    flat_tree *ft = ft_new_from_tree(dt);
+    if(ft == NULL || ft_save(ft, argv[6]) != 0) {
+        return 1;
+    }
+    printf("Saved %d node model (%lu bytes) to %s\n",
+            ft->nodecount, (unsigned long)ft_bytes(ft), argv[6]);
+
+    ft_free(ft);
+    ds_free(train_ds);
+    ds_free(validate.ds);
+    dt_free(dt);
+    return 0;
+}
+
+void print_sparse_set_info(char *name, sparse_set *ss) {
+    printf("%s data set has %u rows, %u columns, %lu nonzeros\n",
+            name, ss->rowcount, ss->colcount, ss->nnz);
+}
+
+// dt_main --libsvm [entropy|gini] noprune <train file> <validate file> <test file> <prediction file>
+// the default mode for libsvm files, which stay sparse from start to finish
+int libsvm_main(int argc, char *argv[]) {
+    if(argc != 7) {
+        fprintf(stderr, "Usage: %s --libsvm [entropy|gini] noprune <train file> <validate file> <test file> <prediction file>\n", argv[0]);
+        return 1;
+    }
+
+    split_criterion criterion;
+    prune_options prune;
+    if(parse_criterion(argv[1], &criterion) != 0 || parse_prune(argv[2], &prune) != 0) {
+        return 1;
+    }
+    // pruning walks dense rows
+    if(prune.mode != PRUNE_NONE) {
+        fprintf(stderr, "--libsvm only supports noprune\n");
+        return 1;
+    }
+
+    writer *prediction_file = wr_open(argv[6], raw_predictions ? WR_RAW : WR_CSV);
+    if(prediction_file == NULL) {
+        return 1;
+    }
+
+    sparse_set *train_ss = ss_new_from_libsvm(argv[3]);
+    if(train_ss == NULL) {
+        return 1;
+    }
+    print_sparse_set_info("Training", train_ss);
+
+    decision_tree *dt = dt_new(0, criterion);
+    printf("Training decision tree on training data set...\n");
+    if(dt_train_sparse(dt, train_ss) != 0) {
+        fprintf(stderr, "Training failed\n");
+        dt_free(dt);
+        ss_free(train_ss);
+        wr_close(prediction_file);
+        remove(argv[6]);
+        return 1;
+    }
+    printf("Training successful\n");
+
+    sparse_set *validate_ss = ss_new_from_libsvm(argv[4]);
+    if(validate_ss == NULL) {
+        return 1;
+    }
+    print_sparse_set_info("Validation", validate_ss);
+
+    printf("Scoring validation data set\n");
+    float *preds = dt_predict_sparse(dt, validate_ss);
+    unsigned int correct = 0;
+    for(unsigned int i = 0; i < validate_ss->rowcount; i++) {
+        if(preds[i] == validate_ss->y_data[i]) {
+            correct += 1;
+        }
+    }
+    free(preds);
+    printf("Score: %.4f\n", (float)correct / validate_ss->rowcount);
 
-    printf("Saving predictions to %s\n", argv[5]);
-    fprintf(prediction_file, "Id,Prediction\n");
-    for(int i = 0; i < test_ds->rowcount; i++) {
-        fprintf(prediction_file, "%d,%d\n", i+1, (int)(preds[i]));
+    // the labels of the test rows are there to keep the format, not used
+    sparse_set *test_ss = ss_new_from_libsvm(argv[5]);
+    if(test_ss == NULL) {
+        return 1;
     }
+    print_sparse_set_info("Test", test_ss);
 
+    printf("Running predictions for test data, saving them to %s\n", argv[6]);
+    preds = dt_predict_sparse(dt, test_ss);
+    wr_write(prediction_file, preds, test_ss->rowcount);
     free(preds);
+    int result = wr_close(prediction_file) == 0 ? 0 : 1;
 
     printf("Free data sets\n");
+    ss_free(train_ss);
+    ss_free(validate_ss);
+    ss_free(test_ss);
+    printf("Free decision tree\n");
+    dt_free(dt);
+
+    return result;
+}
+
+// dt_main serve <model file> [socket path|-] [max batch] [max wait us]
+// everything but the predictions goes to stderr, stdout may be the channel
+int serve_main(int argc, char *argv[]) {
+    if(argc < 3 || argc > 6) {
+        fprintf(stderr, "Usage: %s serve <model file> [socket path|-] [max batch] [max wait us]\n", argv[0]);
+        return 1;
+    }
+
+    server_options opts;
+    server_default_options(&opts);
+    if(argc > 3 && strcmp(argv[3], "-") != 0) {
+        opts.socket_path = argv[3];
+    }
+    if(argc > 4) {
+        opts.max_batch = atoi(argv[4]);
+    }
+    if(argc > 5) {
+        opts.max_wait_us = atoi(argv[5]);
+    }
+
+    flat_tree *ft = ft_load(argv[2]);
+    if(ft == NULL) {
+        return 1;
+    }
+
+    fprintf(stderr, "Batching up to %d rows, waiting at most %d us\n",
+            opts.max_batch, opts.max_wait_us);
+    int result = server_run(ft, &opts);
+    ft_free(ft);
+    return result == 0 ? 0 : 1;
+}
+
+// dt_main profile <model file> <csv> [output model file]
+// the csv holds representative rows, without y values
+int profile_main(int argc, char *argv[]) {
+    if(argc < 4 || argc > 5) {
+        fprintf(stderr, "Usage: %s profile <model file> <csv> [output model file]\n", argv[0]);
+        return 1;
+    }
+
+    flat_tree *ft = ft_load(argv[2]);
+    if(ft == NULL) {
+        return 1;
+    }
+    csv_file *csv = csv_new_list(argv[3], 0);
+    if(csv == NULL) {
+        fprintf(stderr, "Failed to open CSV file\n");
+        return 1;
+    }
+    data_set *ds = ds_create_from_csv(csv, 0);
+    csv_free(csv);
+    print_data_set_info("Profile", ds);
+    if(ds->colcount < ft->colcount) {
+        fprintf(stderr, "The model needs %u columns\n", ft->colcount);
+        return 1;
+    }
+
+    printf("Profiling %u node model\n", ft->nodecount);
+    ft_profile(ft, ds);
+
+    // how far the typical row gets before leaving the front of the array
+    ft_reorder(ft);
+    uint64_t total = 0;
+    uint64_t hot = 0;
+    for(unsigned int i = 0; i < ft->nodecount; i++) {
+        total += ft->visits[i];
+        if(i < 64 / sizeof(ft_node) * 4) {
+            hot += ft->visits[i];
+        }
+    }
+    printf("Reordered, %.1f%% of node visits now hit the first 4 cache lines\n",
+            total > 0 ? 100.0 * hot / total : 0.0);
+
+    char *output = argc > 4 ? argv[4] : argv[2];
+    int result = ft_save(ft, output);
+    if(result == 0) {
+        printf("Saved profiled model to %s\n", output);
+    }
+    ft_free(ft);
+    ds_free(ds);
+    return result == 0 ? 0 : 1;
+}
+
+// dt_main export <model file> <c file> [function name]
+int export_main(int argc, char *argv[]) {
+    if(argc < 4 || argc > 5) {
+        fprintf(stderr, "Usage: %s export <model file> <c file> [function name]\n", argv[0]);
+        return 1;
+    }
+
+    flat_tree *ft = ft_load(argv[2]);
+    if(ft == NULL) {
+        return 1;
+    }
+    char *name = argc > 4 ? argv[4] : "dt_classify_row";
+    int result = ft_export_c(ft, argv[3], name);
+    if(result == 0) {
+        printf("Exported %u node model as %s() to %s%s\n", ft->nodecount, name,
+                argv[3], ft->visits != NULL ? ", with branch hints" : "");
+    }
+    ft_free(ft);
+    return result == 0 ? 0 : 1;
+}
+
+// dt_main cv [entropy|gini] [prune|noprune] <data csv> <k> [threads]
+int cv_main(int argc, char *argv[]) {
+    if(argc < 6 || argc > 7) {
+        fprintf(stderr, "Usage: %s cv [entropy|gini] [prune|noprune] <data csv> <k> [threads]\n", argv[0]);
+        return 1;
+    }
+
+    dt_options opts;
+    dt_default_options(&opts);
+    prune_options prune;
+    if(parse_criterion(argv[2], &opts.criterion) != 0 || parse_prune(argv[3], &prune) != 0) {
+        return 1;
+    }
+    if(prune.mode != PRUNE_NONE && prune.mode != PRUNE_GREEDY) {
+        fprintf(stderr, "Cross-validation only supports prune or noprune\n");
+        return 1;
+    }
+    opts.prune = prune.mode == PRUNE_GREEDY;
+    int k = atoi(argv[5]);
+    if(argc > 6) {
+        opts.threads = atoi(argv[6]);
+    }
+
+    csv_file *csv = csv_new_list(argv[4], 0);
+    if(csv == NULL) {
+        fprintf(stderr, "Failed to open CSV file\n");
+        return 1;
+    }
+    data_set *ds = ds_create_from_csv(csv, 1);
+    csv_free(csv);
+    if(mark_categorical(ds) != 0) {
+        return 1;
+    }
+    print_data_set_info("Cross-validation", ds);
+
+    printf("Training %d folds...\n", k);
+    dt_cv_result *result = dt_cross_validate(ds, k, &opts);
+    if(result == NULL) {
+        return 1;
+    }
+
+    for(int f = 0; f < result->k; f++) {
+        printf("Fold %d: score %.4f, %d nodes\n", f + 1,
+                result->fold_scores[f], result->fold_nodes[f]);
+    }
+    printf("Mean score: %.4f (stddev %.4f)\n", result->mean_score, result->stddev_score);
+
+    dt_cv_free(result);
+    ds_free(ds);
+    return 0;
+}
+
+// dt_main sweep <train csv> <validate csv> [max depths] [threads]
+// max depths is a comma separated list, 0 means no limit
+int sweep_main(int argc, char *argv[]) {
+    if(argc < 4 || argc > 6) {
+        fprintf(stderr, "Usage: %s sweep <train csv> <validate csv> [max depths] [threads]\n", argv[0]);
+        return 1;
+    }
+
+    int depthcount = 0;
+    int depths[64];
+    char *depth_str = argc > 4 ? argv[4] : "0";
+    while(*depth_str != '\0' && depthcount < 64) {
+        char *end;
+        depths[depthcount] = strtol(depth_str, &end, 10);
+        if(end == depth_str || depths[depthcount] < 0) {
+            fprintf(stderr, "Bad max depth list: %s\n", argv[4]);
+            return 1;
+        }
+        depthcount += 1;
+        depth_str = *end == ',' ? end + 1 : end;
+    }
+    int threads = argc > 5 ? atoi(argv[5]) : 0;
+
+    csv_file *train_csv = csv_new_list(argv[2], 0);
+    csv_file *validate_csv = csv_new_list(argv[3], 0);
+    if(train_csv == NULL || validate_csv == NULL) {
+        fprintf(stderr, "Failed to open the training or validation CSV file\n");
+        return 1;
+    }
+    data_set *train_ds = load_training_set(train_csv);
+    csv_free(train_csv);
+    if(train_ds == NULL) {
+        return 1;
+    }
+    data_set *validate_ds = ds_create_from_csv(validate_csv, 1);
+    csv_free(validate_csv);
+    print_data_set_info("Training", train_ds);
+    print_data_set_info("Validation", validate_ds);
+
+    // every combination of criterion, pruning and depth
+    int count = 0;
+    dt_sweep_config *configs = malloc(4 * depthcount * sizeof(dt_sweep_config));
+    for(int c = 0; c < 2; c++) {
+        for(int d = 0; d < depthcount; d++) {
+            for(int p = 0; p < 2; p++) {
+                configs[count].criterion = c == 0 ? CR_GINI : CR_ENTROPY;
+                configs[count].prune = p;
+                configs[count].max_depth = depths[d];
+                count += 1;
+            }
+        }
+    }
+
+    printf("Sweeping %d configurations...\n", count);
+    dt_sweep_result *results = dt_sweep(train_ds, validate_ds, configs, count, threads);
+    if(results == NULL) {
+        return 1;
+    }
+
+    printf("\nrank  criterion  prune    depth   score   nodes  train ms  prune ms\n");
+    for(int i = 0; i < count; i++) {
+        dt_sweep_result *r = &results[i];
+        char depth[16];
+        if(r->config.max_depth > 0) {
+            sprintf(depth, "%d", r->config.max_depth);
+        }
+        else {
+            sprintf(depth, "none");
+        }
+        printf("%4d  %-9s  %-7s  %5s  %.4f  %6d  %8.1f  %8.1f\n", i + 1,
+                r->config.criterion == CR_GINI ? "gini" : "entropy",
+                r->config.prune ? "prune" : "noprune", depth,
+                r->score, r->nodes, r->train_ms, r->prune_ms);
+    }
+
+    free(results);
+    free(configs);
     ds_free(train_ds);
     ds_free(validate_ds);
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    // global options come before the mode
+    while(argc > 1 && strncmp(argv[1], "--", 2) == 0) {
+        if(strcmp(argv[1], "--dedup") == 0) {
+            dedup_training = 1;
+        }
+        else if(strcmp(argv[1], "--levelwise") == 0) {
+            levelwise = 1;
+        }
+        else if(strncmp(argv[1], "--categorical=", 14) == 0) {
+            categorical_columns = argv[1] + 14;
+        }
+        else if(strcmp(argv[1], "--libsvm") == 0) {
+            libsvm_input = 1;
+        }
+        else if(strcmp(argv[1], "--raw-predictions") == 0) {
+            raw_predictions = 1;
+        }
+        else if(strncmp(argv[1], "--workers=", 10) == 0 && atoi(argv[1] + 10) > 0) {
+            workers = atoi(argv[1] + 10);
+        }
+        else if(strncmp(argv[1], "--sample=", 9) == 0 &&
+                atof(argv[1] + 9) > 0 && atof(argv[1] + 9) < 1) {
+            sample_rate = atof(argv[1] + 9);
+        }
+        else {
+            fprintf(stderr, "Unknown option: %s\n", argv[1]);
+            fprintf(stderr, "Use '--dedup', '--levelwise', '--workers=<processes>', "
+                    "'--categorical=<columns>', '--libsvm', '--raw-predictions' or "
+                    "'--sample=<rate between 0 and 1>'\n");
+            return 1;
+        }
+        argv[1] = argv[0];
+        argv += 1;
+        argc -= 1;
+    }
+    // the level-wise builders always build the exact tree
+    if(sample_rate > 0 && (levelwise || workers > 0)) {
+        fprintf(stderr, "--sample can't be combined with --levelwise or --workers\n");
+        return 1;
+    }
+    // the sparse trainer has none of the training options, and only the
+    // default mode reads libsvm files
+    if(libsvm_input && (dedup_training || levelwise || workers > 0 ||
+                sample_rate > 0 || categorical_columns != NULL)) {
+        fprintf(stderr, "--libsvm can only be combined with --raw-predictions\n");
+        return 1;
+    }
+    if(libsvm_input && argc > 1 && (strcmp(argv[1], "train") == 0 ||
+                strcmp(argv[1], "cv") == 0 || strcmp(argv[1], "sweep") == 0 ||
+                strcmp(argv[1], "profile") == 0 || strcmp(argv[1], "export") == 0 ||
+                strcmp(argv[1], "serve") == 0)) {
+        fprintf(stderr, "--libsvm only works without a mode\n");
+        return 1;
+    }
+
+    if(argc > 1 && strcmp(argv[1], "serve") == 0) {
+        return serve_main(argc, argv);
+    }
+
+    printf("Decision tree!\n");
+
+    if(libsvm_input) {
+        return libsvm_main(argc, argv);
+    }
+
+    if(argc > 1 && strcmp(argv[1], "train") == 0) {
+        return train_main(argc, argv);
+    }
+
+    if(argc > 1 && strcmp(argv[1], "cv") == 0) {
+        return cv_main(argc, argv);
+    }
+
+    if(argc > 1 && strcmp(argv[1], "sweep") == 0) {
+        return sweep_main(argc, argv);
+    }
+
+    if(argc > 1 && strcmp(argv[1], "profile") == 0) {
+        return profile_main(argc, argv);
+    }
+
+    if(argc > 1 && strcmp(argv[1], "export") == 0) {
+        return export_main(argc, argv);
+    }
+
+    if(argc != 7) {
+        fprintf(stderr, "Usage: %s [options] [entropy|gini] [prune|noprune|ccp=N|budget=N] <train csv> <valiate csv> <test csv> <prediction file>\n", argv[0]);
+        fprintf(stderr, "       %s --libsvm [entropy|gini] noprune <train file> <validate file> <test file> <prediction file>\n", argv[0]);
+        fprintf(stderr, "       %s [options] train [entropy|gini] [prune|noprune|ccp=N|budget=N] <train csv> <validate csv> <model file>\n", argv[0]);
+        fprintf(stderr, "       %s cv [entropy|gini] [prune|noprune] <data csv> <k> [threads]\n", argv[0]);
+        fprintf(stderr, "       %s [options] sweep <train csv> <validate csv> [max depths] [threads]\n", argv[0]);
+        fprintf(stderr, "       %s profile <model file> <csv> [output model file]\n", argv[0]);
+        fprintf(stderr, "       %s export <model file> <c file> [function name]\n", argv[0]);
+        fprintf(stderr, "       %s serve <model file> [socket path|-] [max batch] [max wait us]\n", argv[0]);
+        return 1;
+    }
+
+    split_criterion criterion;
+    prune_options prune;
+    if(parse_criterion(argv[1], &criterion) != 0) {
+        return 1;
+    }
+
+    if(parse_prune(argv[2], &prune) != 0) {
+        return 1;
+    }
+
+    writer *prediction_file = wr_open(argv[6], raw_predictions ? WR_RAW : WR_CSV);
+    if(prediction_file == NULL) {
+        return 1;
+    }
+
+    // the validation and test sets aren't needed until training is done, so
+    // they load in the background while the training set loads and trains
+    csv_loader validate;
+    csv_loader test;
+    csv_loader_start(&validate, argv[4], 1);
+    // 0 means no y data
+    csv_loader_start(&test, argv[5], 0);
+
+    csv_file *train_csv = csv_new_list(argv[3], 0);
+    if(train_csv == NULL) {
+        fprintf(stderr, "Failed to open training CSV file\n");
+        return 1;
+    }
+    data_set *train_ds = load_training_set(train_csv);
+    csv_free(train_csv);
+    if(train_ds == NULL) {
+        return 1;
+    }
+    print_data_set_info("Training", train_ds);
+
+    decision_tree *dt = train_and_prune(criterion, &prune, train_ds, &validate);
+    if(dt == NULL) {
+        // don't leave a prediction file behind that looks like a result
+        wr_close(prediction_file);
+        remove(argv[6]);
+        return 1;
+    }
+
+    data_set *test_ds = csv_loader_finish(&test);
+    if(test_ds == NULL) {
+        fprintf(stderr, "Failed to open test CSV file\n");
+        return 1;
+    }
+    print_data_set_info("Test", test_ds);
+
+    // predictions are made a chunk at a time and handed to the writer
+    // thread, which formats and writes each one while the next is predicted
+    flat_tree *ft = ft_new_from_tree(dt);
+    if(ft != NULL) {
+        printf("Flattened tree to %d nodes, %lu bytes\n",
+                ft->nodecount, (unsigned long)ft_bytes(ft));
+    }
+    printf("Running predictions for test data, saving them to %s\n", argv[6]);
+    float *preds = malloc(PREDICTION_CHUNK * sizeof(float));
+    for(unsigned int i = 0; i < test_ds->rowcount; i += PREDICTION_CHUNK) {
+        unsigned int count = test_ds->rowcount - i < PREDICTION_CHUNK ?
+            test_ds->rowcount - i : PREDICTION_CHUNK;
+        if(ft != NULL && ft_bytes(ft) > FT_BLOCKED_MIN_BYTES) {
+            ft_predict_blocked(ft, &test_ds->x_data[i], count, preds);
+        }
+        else {
+            for(unsigned int j = 0; j < count; j++) {
+                float *x = test_ds->x_data[i + j];
+                preds[j] = ft != NULL ? ft_classify(ft, x) : dt_predict_row(dt, x);
+            }
+        }
+        wr_write(prediction_file, preds, count);
+    }
+    free(preds);
+    int result = wr_close(prediction_file) == 0 ? 0 : 1;
+    ft_free(ft);
+
+    printf("Free data sets\n");
+    ds_free(train_ds);
+    ds_free(validate.ds);
+    ds_free(test_ds);
     printf("Free decision tree\n");
     dt_free(dt);
 
-    return 0;
+    return result;
 }
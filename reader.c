@@ -0,0 +1,355 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+#ifdef DT_ZSTD
+#include <zstd.h>
+#endif
+#include "reader.h"
+
+#define RD_BUFSIZE 65536
+#define RD_RING_SIZE (1 << 22)
+
+struct reader {
+    char *filename;
+    FILE *f;
+    int compression;
+    // the first bytes of the file, read to detect the compression
+    unsigned char magic[4];
+    size_t magiclen;
+
+    // decompressed bytes handed to rd_getline, buf[pos] up to buf[len]
+    char *buf;
+    size_t pos;
+    size_t len;
+    int failed;
+
+    // compressed files only: the decompressor thread writes ring[head] and
+    // the reader reads ring[tail], both counting bytes since the start
+    char *ring;
+    size_t head;
+    size_t tail;
+    // set by the decompressor when it has written everything it will
+    int done;
+    // set by rd_close to stop the decompressor early
+    int stop;
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+    pthread_t thread;
+};
+
+void* rd_decompress(void *arg);
+int rd_inflate(reader *rd, unsigned char *in, unsigned char *out);
+int rd_push(reader *rd, unsigned char *data, size_t len);
+int rd_fill(reader *rd);
+int rd_magic(unsigned char *magic, size_t len);
+
+reader* rd_open(char *filename) {
+    FILE *f = fopen(filename, "rb");
+    if(!f) {
+        fprintf(stderr, "Unable to open file '%s'\n", filename);
+        return NULL;
+    }
+
+    reader *rd = malloc(sizeof(reader));
+    rd->filename = malloc(strlen(filename) + 1);
+    strcpy(rd->filename, filename);
+    rd->f = f;
+    rd->magiclen = fread(rd->magic, 1, 4, f);
+    rd->buf = malloc(RD_BUFSIZE);
+    rd->pos = 0;
+    rd->len = 0;
+    rd->failed = 0;
+    rd->ring = NULL;
+
+    rd->compression = rd_magic(rd->magic, rd->magiclen);
+    if(rd->compression == RD_ZSTD) {
+#ifndef DT_ZSTD
+        fprintf(stderr, "'%s' is zstd compressed, which needs a build with "
+                "make ZSTD_CFLAGS=-DDT_ZSTD ZSTD_LIBS=-lzstd\n", filename);
+        fclose(f);
+        free(rd->buf);
+        free(rd->filename);
+        free(rd);
+        return NULL;
+#endif
+    }
+
+    if(rd->compression == RD_PLAIN) {
+        // the magic bytes are just the start of the text
+        memcpy(rd->buf, rd->magic, rd->magiclen);
+        rd->len = rd->magiclen;
+        return rd;
+    }
+
+    rd->ring = malloc(RD_RING_SIZE);
+    rd->head = 0;
+    rd->tail = 0;
+    rd->done = 0;
+    rd->stop = 0;
+    pthread_mutex_init(&rd->lock, NULL);
+    pthread_cond_init(&rd->not_empty, NULL);
+    pthread_cond_init(&rd->not_full, NULL);
+    pthread_create(&rd->thread, NULL, rd_decompress, rd);
+    return rd;
+}
+
+int rd_compression(reader *rd) {
+    return rd->compression;
+}
+
+int rd_detect(char *filename) {
+    FILE *f = fopen(filename, "rb");
+    if(!f) {
+        return -1;
+    }
+    unsigned char magic[4];
+    size_t len = fread(magic, 1, 4, f);
+    fclose(f);
+    return rd_magic(magic, len);
+}
+
+ssize_t rd_getline(reader *rd, char **line, size_t *linecap) {
+    size_t n = 0;
+    while(1) {
+        if(rd->pos == rd->len && !rd_fill(rd)) {
+            break;
+        }
+
+        char *start = rd->buf + rd->pos;
+        char *newline = memchr(start, '\n', rd->len - rd->pos);
+        size_t take = newline != NULL ? newline - start + 1 : rd->len - rd->pos;
+        if(*line == NULL || n + take + 1 > *linecap) {
+            *linecap = (n + take + 1) * 2;
+            *line = realloc(*line, *linecap);
+        }
+        memcpy(*line + n, start, take);
+        n += take;
+        rd->pos += take;
+        if(newline != NULL) {
+            break;
+        }
+    }
+
+    if(n == 0) {
+        return -1;
+    }
+    (*line)[n] = '\0';
+    return n;
+}
+
+int rd_close(reader *rd) {
+    if(rd == NULL) {
+        return -1;
+    }
+
+    if(rd->compression != RD_PLAIN) {
+        pthread_mutex_lock(&rd->lock);
+        rd->stop = 1;
+        pthread_cond_broadcast(&rd->not_full);
+        pthread_mutex_unlock(&rd->lock);
+        pthread_join(rd->thread, NULL);
+        pthread_mutex_destroy(&rd->lock);
+        pthread_cond_destroy(&rd->not_empty);
+        pthread_cond_destroy(&rd->not_full);
+        free(rd->ring);
+    }
+
+    int failed = rd->failed;
+    fclose(rd->f);
+    free(rd->buf);
+    free(rd->filename);
+    free(rd);
+    return failed ? -1 : 0;
+}
+
+// private function, the compression that the first bytes of a file belong to
+int rd_magic(unsigned char *magic, size_t len) {
+    if(len >= 2 && magic[0] == 0x1f && magic[1] == 0x8b) {
+        return RD_GZIP;
+    }
+    if(len == 4 && magic[0] == 0x28 && magic[1] == 0xb5 && magic[2] == 0x2f && magic[3] == 0xfd) {
+        return RD_ZSTD;
+    }
+    return RD_PLAIN;
+}
+
+// private function, refills buf with the next bytes of the file
+// returns 0 at the end of the file
+int rd_fill(reader *rd) {
+    rd->pos = 0;
+    if(rd->compression == RD_PLAIN) {
+        rd->len = fread(rd->buf, 1, RD_BUFSIZE, rd->f);
+        if(rd->len == 0 && ferror(rd->f)) {
+            fprintf(stderr, "Failed to read '%s'\n", rd->filename);
+            rd->failed = 1;
+        }
+        return rd->len > 0;
+    }
+
+    pthread_mutex_lock(&rd->lock);
+    while(rd->head == rd->tail && !rd->done) {
+        pthread_cond_wait(&rd->not_empty, &rd->lock);
+    }
+    size_t n = rd->head - rd->tail;
+    if(n > RD_BUFSIZE) {
+        n = RD_BUFSIZE;
+    }
+    for(size_t copied = 0; copied < n; ) {
+        size_t at = (rd->tail + copied) % RD_RING_SIZE;
+        size_t run = RD_RING_SIZE - at < n - copied ? RD_RING_SIZE - at : n - copied;
+        memcpy(rd->buf + copied, rd->ring + at, run);
+        copied += run;
+    }
+    rd->tail += n;
+    pthread_cond_signal(&rd->not_full);
+    pthread_mutex_unlock(&rd->lock);
+
+    rd->len = n;
+    return n > 0;
+}
+
+// private function, copies decompressed bytes into the ring buffer, waiting
+// for the reader to make room. returns 0 if the reader was closed
+int rd_push(reader *rd, unsigned char *data, size_t len) {
+    pthread_mutex_lock(&rd->lock);
+    while(len > 0 && !rd->stop) {
+        while(rd->head - rd->tail == RD_RING_SIZE && !rd->stop) {
+            pthread_cond_wait(&rd->not_full, &rd->lock);
+        }
+        size_t space = RD_RING_SIZE - (rd->head - rd->tail);
+        size_t at = rd->head % RD_RING_SIZE;
+        size_t run = RD_RING_SIZE - at;
+        if(run > space) {
+            run = space;
+        }
+        if(run > len) {
+            run = len;
+        }
+        memcpy(rd->ring + at, data, run);
+        rd->head += run;
+        data += run;
+        len -= run;
+        pthread_cond_signal(&rd->not_empty);
+    }
+    int stopped = rd->stop;
+    pthread_mutex_unlock(&rd->lock);
+    return !stopped;
+}
+
+// private function, the decompressor thread of a compressed file
+void* rd_decompress(void *arg) {
+    reader *rd = arg;
+    unsigned char *in = malloc(RD_BUFSIZE);
+    unsigned char *out = malloc(RD_BUFSIZE);
+
+    // the magic bytes were already read, they are the start of the input
+    memcpy(in, rd->magic, rd->magiclen);
+    int ok = rd_inflate(rd, in, out);
+
+    pthread_mutex_lock(&rd->lock);
+    if(!ok && !rd->stop) {
+        fprintf(stderr, "'%s' is corrupt or truncated\n", rd->filename);
+        rd->failed = 1;
+    }
+    rd->done = 1;
+    pthread_cond_broadcast(&rd->not_empty);
+    pthread_mutex_unlock(&rd->lock);
+
+    free(in);
+    free(out);
+    return NULL;
+}
+
+// private function, decompresses the whole file into the ring buffer
+// in holds the magic bytes to start with. returns 0 on corrupt input
+int rd_inflate(reader *rd, unsigned char *in, unsigned char *out) {
+    size_t inlen = rd->magiclen + fread(in + rd->magiclen, 1, RD_BUFSIZE - rd->magiclen, rd->f);
+    // the decompressor may have output left over with no new input
+    int pending = 0;
+    // a gzip member or zstd frame has been started but not finished
+    int open = 0;
+
+    if(rd->compression == RD_GZIP) {
+        z_stream zs;
+        memset(&zs, 0, sizeof(zs));
+        // 32 makes zlib read the gzip header
+        if(inflateInit2(&zs, 15 + 32) != Z_OK) {
+            return 0;
+        }
+        zs.next_in = in;
+        zs.avail_in = inlen;
+
+        while(1) {
+            if(zs.avail_in == 0 && !pending) {
+                inlen = fread(in, 1, RD_BUFSIZE, rd->f);
+                if(inlen == 0) {
+                    break;
+                }
+                zs.next_in = in;
+                zs.avail_in = inlen;
+            }
+
+            if(zs.avail_in > 0) {
+                open = 1;
+            }
+            zs.next_out = out;
+            zs.avail_out = RD_BUFSIZE;
+            int ret = inflate(&zs, Z_NO_FLUSH);
+            if(ret == Z_STREAM_END) {
+                // gzip files can be several members one after another
+                open = 0;
+                inflateReset(&zs);
+            }
+            else if(ret != Z_OK && ret != Z_BUF_ERROR) {
+                inflateEnd(&zs);
+                return 0;
+            }
+            pending = zs.avail_out == 0;
+
+            if(!rd_push(rd, out, RD_BUFSIZE - zs.avail_out)) {
+                break;
+            }
+        }
+        inflateEnd(&zs);
+        return !open || rd->stop;
+    }
+
+#ifdef DT_ZSTD
+    ZSTD_DStream *ds = ZSTD_createDStream();
+    ZSTD_initDStream(ds);
+    ZSTD_inBuffer input = { in, inlen, 0 };
+    while(1) {
+        if(input.pos == input.size && !pending) {
+            inlen = fread(in, 1, RD_BUFSIZE, rd->f);
+            if(inlen == 0) {
+                break;
+            }
+            input.size = inlen;
+            input.pos = 0;
+        }
+
+        ZSTD_outBuffer output = { out, RD_BUFSIZE, 0 };
+        size_t ret = ZSTD_decompressStream(ds, &output, &input);
+        if(ZSTD_isError(ret)) {
+            ZSTD_freeDStream(ds);
+            return 0;
+        }
+        // 0 means a frame was just finished
+        open = ret != 0;
+        pending = output.pos == output.size;
+
+        if(!rd_push(rd, out, output.pos)) {
+            break;
+        }
+    }
+    ZSTD_freeDStream(ds);
+    return !open || rd->stop;
+#else
+    return 0;
+#endif
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stddef.h>
+#include <sys/types.h>
+
+// line reader over plain, gzip or zstd compressed files
+// the compression is detected from the first bytes of the file, not the
+// name. compressed files are decompressed on a thread of their own, which
+// feeds the reader through a ring buffer, so nothing is written to disk
+// zstd support needs libzstd, build with
+// make ZSTD_CFLAGS=-DDT_ZSTD ZSTD_LIBS=-lzstd
+typedef struct reader reader;
+
+#define RD_PLAIN 0
+#define RD_GZIP 1
+#define RD_ZSTD 2
+
+// open filename for reading, returns NULL (after printing why) on failure
+reader* rd_open(char *filename);
+
+// one of RD_PLAIN, RD_GZIP or RD_ZSTD
+int rd_compression(reader *rd);
+
+// the compression of filename without opening a reader, -1 if it can't be read
+int rd_detect(char *filename);
+
+// same as getline(3): reads the next line, including its newline, into
+// *line (growing it as needed) and returns its length, or -1 at the end of
+// the file or after an error
+ssize_t rd_getline(reader *rd, char **line, size_t *linecap);
+
+// close the reader, returns 0 if the whole file was read without errors
+int rd_close(reader *rd);
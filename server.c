@@ -0,0 +1,452 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "csv.h"
+#include "server.h"
+
+// the most recent latencies are kept for the percentile report
+#define SV_LATENCY_SAMPLES (1 << 20)
+#define SV_READ_SIZE 65536
+
+typedef struct sv_request {
+    float *x;
+    // set for the STATS command instead of a row
+    int stats;
+    int parsed;
+    int done;
+    float prediction;
+    struct timespec queued;
+    struct sv_request *next;
+} sv_request;
+
+typedef struct sv_state {
+    flat_tree *ft;
+    server_options *opts;
+    pthread_mutex_t lock;
+    // signalled when rows are queued, waited on by the batcher
+    pthread_cond_t queued_cond;
+    // broadcast when a batch is finished, waited on by the connections
+    pthread_cond_t done_cond;
+    sv_request *head;
+    sv_request *tail;
+    int queue_len;
+    int stopping;
+    float *latencies;
+    unsigned long requests;
+    unsigned long batches;
+} sv_state;
+
+typedef struct sv_connection {
+    sv_state *state;
+    int fd_in;
+    int fd_out;
+} sv_connection;
+
+static volatile sig_atomic_t sv_interrupted = 0;
+
+void* sv_batcher(void *arg);
+void* sv_connection_thread(void *arg);
+void sv_handle_connection(sv_state *state, int fd_in, int fd_out);
+int sv_write_all(int fd, char *buf, size_t len);
+void sv_stats_line(sv_state *state, char *buf, size_t len);
+void sv_on_signal(int sig);
+
+void server_default_options(server_options *opts) {
+    opts->socket_path = NULL;
+    opts->max_batch = 64;
+    opts->max_wait_us = 200;
+}
+
+int server_run(flat_tree *ft, server_options *opts) {
+    sv_state state;
+    state.ft = ft;
+    state.opts = opts;
+    state.head = NULL;
+    state.tail = NULL;
+    state.queue_len = 0;
+    state.stopping = 0;
+    state.latencies = malloc(SV_LATENCY_SAMPLES * sizeof(float));
+    state.requests = 0;
+    state.batches = 0;
+
+    if(opts->max_batch < 1) {
+        opts->max_batch = 1;
+    }
+
+    pthread_condattr_t condattr;
+    pthread_condattr_init(&condattr);
+    pthread_condattr_setclock(&condattr, CLOCK_MONOTONIC);
+    pthread_mutex_init(&state.lock, NULL);
+    pthread_cond_init(&state.queued_cond, &condattr);
+    pthread_cond_init(&state.done_cond, NULL);
+    pthread_condattr_destroy(&condattr);
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = SIG_IGN;
+    sigaction(SIGPIPE, &sa, NULL);
+
+    // only the main thread should see SIGINT/SIGTERM, so that accept()
+    // gets interrupted
+    sigset_t blocked, oldmask;
+    sigemptyset(&blocked);
+    sigaddset(&blocked, SIGINT);
+    sigaddset(&blocked, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &blocked, &oldmask);
+
+    pthread_t batcher;
+    pthread_create(&batcher, NULL, sv_batcher, &state);
+
+    int result = 0;
+    if(opts->socket_path == NULL) {
+        pthread_sigmask(SIG_SETMASK, &oldmask, NULL);
+        fprintf(stderr, "Serving %d node model on stdin/stdout\n", ft->nodecount);
+        sv_handle_connection(&state, 0, 1);
+    }
+    else {
+        int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, opts->socket_path, sizeof(addr.sun_path) - 1);
+        unlink(opts->socket_path);
+
+        if(listen_fd < 0 ||
+                bind(listen_fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+                listen(listen_fd, 128) != 0) {
+            fprintf(stderr, "Unable to listen on '%s': %s\n",
+                    opts->socket_path, strerror(errno));
+            result = -1;
+        }
+        else {
+            fprintf(stderr, "Serving %d node model on %s\n",
+                    ft->nodecount, opts->socket_path);
+
+            sa.sa_handler = sv_on_signal;
+            // no SA_RESTART, accept() has to return on a signal
+            sa.sa_flags = 0;
+            sigaction(SIGINT, &sa, NULL);
+            sigaction(SIGTERM, &sa, NULL);
+
+            while(!sv_interrupted) {
+                pthread_sigmask(SIG_SETMASK, &oldmask, NULL);
+                int fd = accept(listen_fd, NULL, NULL);
+                pthread_sigmask(SIG_BLOCK, &blocked, NULL);
+                if(fd < 0) {
+                    if(errno != EINTR) {
+                        fprintf(stderr, "accept failed: %s\n", strerror(errno));
+                    }
+                    continue;
+                }
+
+                sv_connection *conn = malloc(sizeof(sv_connection));
+                conn->state = &state;
+                conn->fd_in = fd;
+                conn->fd_out = fd;
+                pthread_t thread;
+                pthread_create(&thread, NULL, sv_connection_thread, conn);
+                pthread_detach(thread);
+            }
+            unlink(opts->socket_path);
+        }
+
+        if(listen_fd >= 0) {
+            close(listen_fd);
+        }
+    }
+
+    pthread_mutex_lock(&state.lock);
+    state.stopping = 1;
+    pthread_cond_signal(&state.queued_cond);
+    pthread_mutex_unlock(&state.lock);
+    pthread_join(batcher, NULL);
+
+    char stats[256];
+    sv_stats_line(&state, stats, sizeof(stats));
+    fprintf(stderr, "%s", stats);
+
+    // connection threads that are still running can touch the state until
+    // the process exits, so it is deliberately not torn down here
+    return result;
+}
+
+void sv_on_signal(int sig) {
+    sv_interrupted = 1;
+}
+
+// private function, the batching thread
+// pulls up to max_batch rows off the queue and classifies them together
+void* sv_batcher(void *arg) {
+    sv_state *state = arg;
+    server_options *opts = state->opts;
+    sv_request **batch = malloc(opts->max_batch * sizeof(sv_request*));
+    // the rows of a batch are copied side by side and classified in place
+    unsigned int colcount = state->ft->colcount;
+    float *rows = malloc(opts->max_batch * colcount * sizeof(float));
+    float *preds = malloc(opts->max_batch * sizeof(float));
+
+    pthread_mutex_lock(&state->lock);
+    while(1) {
+        while(state->queue_len == 0 && !state->stopping) {
+            pthread_cond_wait(&state->queued_cond, &state->lock);
+        }
+        if(state->queue_len == 0) {
+            break;
+        }
+
+        // hold a partial batch back until the oldest row has waited long enough
+        struct timespec deadline = state->head->queued;
+        deadline.tv_nsec += opts->max_wait_us * 1000L;
+        deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+        deadline.tv_nsec %= 1000000000L;
+        while(state->queue_len < opts->max_batch && !state->stopping) {
+            if(pthread_cond_timedwait(&state->queued_cond, &state->lock,
+                        &deadline) == ETIMEDOUT) {
+                break;
+            }
+        }
+
+        int n = 0;
+        while(n < opts->max_batch && state->head != NULL) {
+            batch[n] = state->head;
+            state->head = state->head->next;
+            n += 1;
+        }
+        if(state->head == NULL) {
+            state->tail = NULL;
+        }
+        state->queue_len -= n;
+        pthread_mutex_unlock(&state->lock);
+
+        for(int i = 0; i < n; i++) {
+            memcpy(rows + i * colcount, batch[i]->x, colcount * sizeof(float));
+        }
+        ft_predict_strided(state->ft, rows, n, colcount, 1, preds);
+
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+
+        pthread_mutex_lock(&state->lock);
+        for(int i = 0; i < n; i++) {
+            batch[i]->prediction = preds[i];
+            batch[i]->done = 1;
+
+            float us = (now.tv_sec - batch[i]->queued.tv_sec) * 1e6f +
+                (now.tv_nsec - batch[i]->queued.tv_nsec) / 1e3f;
+            state->latencies[state->requests % SV_LATENCY_SAMPLES] = us;
+            state->requests += 1;
+        }
+        state->batches += 1;
+        pthread_cond_broadcast(&state->done_cond);
+    }
+    pthread_mutex_unlock(&state->lock);
+
+    free(batch);
+    free(rows);
+    free(preds);
+    return NULL;
+}
+
+void* sv_connection_thread(void *arg) {
+    sv_connection *conn = arg;
+    sv_handle_connection(conn->state, conn->fd_in, conn->fd_out);
+    close(conn->fd_in);
+    free(conn);
+    return NULL;
+}
+
+// private function, reads request lines from fd_in until EOF
+// every complete line in a read is queued at once, and the replies are
+// written back together once the batcher has classified all of them
+void sv_handle_connection(sv_state *state, int fd_in, int fd_out) {
+    unsigned int colcount = state->ft->colcount;
+    size_t bufcap = SV_READ_SIZE;
+    size_t buflen = 0;
+    char *buf = malloc(bufcap);
+
+    int reqcap = 0;
+    sv_request *reqs = NULL;
+    size_t outcap = 0;
+    char *out = NULL;
+
+    while(1) {
+        if(bufcap - buflen < SV_READ_SIZE / 2) {
+            bufcap *= 2;
+            buf = realloc(buf, bufcap);
+        }
+        ssize_t got = read(fd_in, buf + buflen, bufcap - buflen - 1);
+        if(got < 0 && errno == EINTR) {
+            continue;
+        }
+        if(got <= 0) {
+            break;
+        }
+        buflen += got;
+
+        // split off the complete lines, the tail is kept for the next read
+        int nlines = 0;
+        size_t consumed = 0;
+        for(size_t i = 0; i < buflen; i++) {
+            if(buf[i] == '\n') {
+                nlines += 1;
+                consumed = i + 1;
+            }
+        }
+        if(nlines == 0) {
+            continue;
+        }
+
+        if(nlines > reqcap) {
+            for(int i = 0; i < reqcap; i++) {
+                free(reqs[i].x);
+            }
+            reqcap = nlines;
+            reqs = realloc(reqs, reqcap * sizeof(sv_request));
+            for(int i = 0; i < reqcap; i++) {
+                reqs[i].x = malloc((colcount + 1) * sizeof(float));
+            }
+        }
+        // a prediction takes well under 32 bytes, a stats line under 256
+        if(outcap < nlines * 256) {
+            outcap = nlines * 256;
+            out = realloc(out, outcap);
+        }
+
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+
+        // parse everything first so the queue lock is only taken once
+        int nreqs = 0;
+        char *line = buf;
+        for(int l = 0; l < nlines; l++) {
+            // the client can send anything, a NUL byte in a line would end
+            // it early for the string functions, so it gets an ERR instead
+            char *end = memchr(line, '\n', buf + consumed - line);
+            int has_nul = memchr(line, '\0', end - line) != NULL;
+            *end = '\0';
+            if(end > line && end[-1] == '\r') {
+                end[-1] = '\0';
+            }
+
+            if(has_nul || *line != '\0') {
+                sv_request *req = &reqs[nreqs];
+                int ncols = 0;
+                req->stats = !has_nul && strcmp(line, "STATS") == 0;
+                if(!has_nul && !req->stats && colcount > 0) {
+                    csv_split_line(line, req->x, colcount, &ncols);
+                }
+                req->parsed = !has_nul && !req->stats && ncols >= colcount;
+                req->done = !req->parsed;
+                req->prediction = 0;
+                req->queued = now;
+                req->next = NULL;
+                nreqs += 1;
+            }
+            line = end + 1;
+        }
+
+        pthread_mutex_lock(&state->lock);
+        for(int i = 0; i < nreqs; i++) {
+            if(reqs[i].parsed) {
+                if(state->tail == NULL) {
+                    state->head = &reqs[i];
+                }
+                else {
+                    state->tail->next = &reqs[i];
+                }
+                state->tail = &reqs[i];
+                state->queue_len += 1;
+            }
+        }
+        pthread_cond_signal(&state->queued_cond);
+
+        for(int i = 0; i < nreqs; i++) {
+            while(!reqs[i].done) {
+                pthread_cond_wait(&state->done_cond, &state->lock);
+            }
+        }
+        pthread_mutex_unlock(&state->lock);
+
+        size_t outlen = 0;
+        for(int i = 0; i < nreqs; i++) {
+            if(reqs[i].stats) {
+                sv_stats_line(state, out + outlen, 256);
+                outlen += strlen(out + outlen);
+            }
+            else if(reqs[i].parsed) {
+                outlen += sprintf(out + outlen, "%g\n", reqs[i].prediction);
+            }
+            else {
+                outlen += sprintf(out + outlen, "ERR\n");
+            }
+        }
+
+        if(sv_write_all(fd_out, out, outlen) != 0) {
+            break;
+        }
+
+        memmove(buf, buf + consumed, buflen - consumed);
+        buflen -= consumed;
+    }
+
+    for(int i = 0; i < reqcap; i++) {
+        free(reqs[i].x);
+    }
+    free(reqs);
+    free(out);
+    free(buf);
+}
+
+int sv_write_all(int fd, char *buf, size_t len) {
+    while(len > 0) {
+        ssize_t n = write(fd, buf, len);
+        if(n < 0 && errno == EINTR) {
+            continue;
+        }
+        if(n <= 0) {
+            return -1;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+int sv_compare_floats(const void *a, const void *b) {
+    float fa = *(const float*)a;
+    float fb = *(const float*)b;
+    return (fa > fb) - (fa < fb);
+}
+
+// private function, formats the request count and latency percentiles
+// takes the state lock itself
+void sv_stats_line(sv_state *state, char *buf, size_t len) {
+    pthread_mutex_lock(&state->lock);
+    unsigned long requests = state->requests;
+    unsigned long batches = state->batches;
+    size_t count = requests < SV_LATENCY_SAMPLES ? requests : SV_LATENCY_SAMPLES;
+    float *sorted = malloc((count + 1) * sizeof(float));
+    memcpy(sorted, state->latencies, count * sizeof(float));
+    pthread_mutex_unlock(&state->lock);
+
+    float p50 = 0;
+    float p99 = 0;
+    if(count > 0) {
+        qsort(sorted, count, sizeof(float), sv_compare_floats);
+        p50 = sorted[(count - 1) / 2];
+        p99 = sorted[(size_t)((count - 1) * 0.99)];
+    }
+    free(sorted);
+
+    snprintf(buf, len, "requests=%lu batches=%lu p50_us=%.1f p99_us=%.1f\n",
+            requests, batches, p50, p99);
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include "flat_tree.h"
+
+typedef struct server_options {
+    // path of the unix domain socket to listen on
+    // if NULL, requests are read from stdin and answered on stdout
+    char *socket_path;
+    // the most rows classified in one batch
+    int max_batch;
+    // how long the oldest waiting row may be held back to fill a batch
+    int max_wait_us;
+} server_options;
+
+// fill in the default batch size and wait time, serving on stdin/stdout
+void server_default_options(server_options *opts);
+
+// serve predictions for the model until stdin is closed (stdin mode) or the
+// process gets SIGINT/SIGTERM (socket mode)
+//
+// protocol: every request is one line of comma separated feature values, and
+// gets one line back holding the predicted class, or "ERR" if the row could
+// not be parsed. replies on a connection come back in request order, so
+// clients may pipeline many rows. the line "STATS" gets a line with the
+// request count and p50/p99 latency in microseconds instead
+//
+// rows from all connections are queued and classified in batches of up to
+// max_batch rows. a partial batch is run once its oldest row has waited
+// max_wait_us microseconds
+// returns 0 on a clean shutdown
+int server_run(flat_tree *ft, server_options *opts);
@@ -0,0 +1,510 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sparse_set.h"
+
+float ss_classify(decision_tree *dt, sparse_set *data, unsigned int row);
+int ss_compare_entries(const void *a, const void *b);
+
+typedef struct ss_entry {
+    unsigned int col;
+    float value;
+} ss_entry;
+
+// a nonzero of a training row, see dt_train_sparse
+typedef struct ss_nonzero {
+    unsigned int col;
+    unsigned int row;
+    float value;
+} ss_nonzero;
+
+sparse_set* ss_new_from_libsvm(char *filename) {
+    FILE *f = fopen(filename, "r");
+    if(!f) {
+        fprintf(stderr, "Unable to open file '%s'\n", filename);
+        return NULL;
+    }
+
+    sparse_set *ss = malloc(sizeof(sparse_set));
+    ss->colcount = 0;
+    ss->rowcount = 0;
+    ss->nnz = 0;
+    ss->has_ydata = 1;
+
+    unsigned int rowcap = 1024;
+    unsigned long nnzcap = 4096;
+    ss->y_data = malloc(rowcap * sizeof(float));
+    ss->row_start = malloc((rowcap + 1) * sizeof(unsigned long));
+    ss->col_index = malloc(nnzcap * sizeof(unsigned int));
+    ss->values = malloc(nnzcap * sizeof(float));
+    ss->row_start[0] = 0;
+
+    int entrycap = 256;
+    ss_entry *entries = malloc(entrycap * sizeof(ss_entry));
+
+    char *line = NULL;
+    size_t linelen = 0;
+    int lineno = 0;
+    while(getline(&line, &linelen, f) > 0) {
+        lineno += 1;
+        char *comment = strchr(line, '#');
+        if(comment != NULL) {
+            *comment = '\0';
+        }
+
+        char *pos = line;
+        char *end;
+        float label = strtof(pos, &end);
+        if(end == pos) {
+            // blank or comment-only line
+            continue;
+        }
+        pos = end;
+
+        int n = 0;
+        char *saveptr;
+        for(char *tok = strtok_r(pos, " \t\r\n", &saveptr); tok != NULL;
+                tok = strtok_r(NULL, " \t\r\n", &saveptr)) {
+            char *colon = strchr(tok, ':');
+            unsigned long index = strtoul(tok, &end, 10);
+            if(colon == NULL || end != colon) {
+                // something like qid:3, which doesn't matter here
+                continue;
+            }
+
+            float value = strtof(colon + 1, &end);
+            if(end == colon + 1) {
+                fprintf(stderr, "Warning! Bad value on line %d of %s\n", lineno, filename);
+                continue;
+            }
+            if(index == 0) {
+                fprintf(stderr, "Warning! Feature index 0 on line %d of %s, indices start at 1\n",
+                        lineno, filename);
+                continue;
+            }
+            if(value == 0) {
+                continue;
+            }
+
+            if(n == entrycap) {
+                entrycap *= 2;
+                entries = realloc(entries, entrycap * sizeof(ss_entry));
+            }
+            entries[n].col = index - 1;
+            entries[n].value = value;
+            n += 1;
+            if(index > ss->colcount) {
+                ss->colcount = index;
+            }
+        }
+
+        qsort(entries, n, sizeof(ss_entry), ss_compare_entries);
+
+        if(ss->rowcount == rowcap) {
+            rowcap *= 2;
+            ss->y_data = realloc(ss->y_data, rowcap * sizeof(float));
+            ss->row_start = realloc(ss->row_start, (rowcap + 1) * sizeof(unsigned long));
+        }
+        while(ss->nnz + n > nnzcap) {
+            nnzcap *= 2;
+            ss->col_index = realloc(ss->col_index, nnzcap * sizeof(unsigned int));
+            ss->values = realloc(ss->values, nnzcap * sizeof(float));
+        }
+
+        for(int i = 0; i < n; i++) {
+            if(i > 0 && entries[i].col == entries[i-1].col) {
+                fprintf(stderr, "Warning! Duplicate feature %u on line %d of %s\n",
+                        entries[i].col + 1, lineno, filename);
+                continue;
+            }
+            ss->col_index[ss->nnz] = entries[i].col;
+            ss->values[ss->nnz] = entries[i].value;
+            ss->nnz += 1;
+        }
+        ss->y_data[ss->rowcount] = label;
+        ss->rowcount += 1;
+        ss->row_start[ss->rowcount] = ss->nnz;
+    }
+
+    free(line);
+    free(entries);
+    fclose(f);
+    return ss;
+}
+
+int ss_compare_entries(const void *a, const void *b) {
+    const ss_entry *ea = a;
+    const ss_entry *eb = b;
+    return (ea->col > eb->col) - (ea->col < eb->col);
+}
+
+void ss_free(sparse_set *ss) {
+    if(ss == NULL) {
+        return;
+    }
+    free(ss->y_data);
+    free(ss->row_start);
+    free(ss->col_index);
+    free(ss->values);
+    free(ss);
+}
+
+float ss_value(sparse_set *ss, unsigned int row, unsigned int col) {
+    unsigned long lo = ss->row_start[row];
+    unsigned long hi = ss->row_start[row + 1];
+    while(lo < hi) {
+        unsigned long mid = lo + (hi - lo) / 2;
+        if(ss->col_index[mid] < col) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+    if(lo < ss->row_start[row + 1] && ss->col_index[lo] == col) {
+        return ss->values[lo];
+    }
+    return 0;
+}
+
+// private function, the index of the largest count (first one on ties)
+int ss_majority(const float *counts, int classcount) {
+    int best = 0;
+    for(int c = 1; c < classcount; c++) {
+        if(counts[c] > counts[best]) {
+            best = c;
+        }
+    }
+    return best;
+}
+
+int dt_train_sparse(decision_tree *dt, sparse_set *train_data) {
+    if(train_data->has_ydata == 0) {
+        fprintf(stderr, "Data set must have y data!\n");
+        return -1;
+    }
+    if(train_data->rowcount == 0) {
+        fprintf(stderr, "No rows in training set!\n");
+        return -1;
+    }
+
+    // the tree doesn't keep a dense copy of the training data
+    dt->dataset = NULL;
+
+    unsigned int rowcount = train_data->rowcount;
+
+    // label encode the y values
+    int classcap = 16;
+    int classcount = 0;
+    float *classes = malloc(classcap * sizeof(float));
+    int *labels = malloc(rowcount * sizeof(int));
+    for(unsigned int r = 0; r < rowcount; r++) {
+        float y = train_data->y_data[r];
+        int c = 0;
+        while(c < classcount && classes[c] != y) {
+            c += 1;
+        }
+        if(c == classcount) {
+            if(classcount == classcap) {
+                classcap *= 2;
+                classes = realloc(classes, classcap * sizeof(float));
+            }
+            classes[classcount] = y;
+            classcount += 1;
+        }
+        labels[r] = c;
+    }
+
+    // every row is tagged with the index of the open node it sits at on the
+    // current level, or -1 once it has reached a leaf
+    int *node_of = calloc(rowcount, sizeof(int));
+
+    int opencount = 1;
+    dt_node **open = malloc(sizeof(dt_node*));
+    float *open_counts = calloc(classcount, sizeof(float));
+    open[0] = dt->root;
+    for(unsigned int r = 0; r < rowcount; r++) {
+        open_counts[labels[r]] += 1;
+    }
+
+    // the rows that sit at open nodes, in order
+    unsigned int *active = malloc(rowcount * sizeof(unsigned int));
+    unsigned int activecount = rowcount;
+    for(unsigned int r = 0; r < rowcount; r++) {
+        active[r] = r;
+    }
+
+    // the slot of every column with nonzeros on the current level (-1 for
+    // the others), the columns of the slots, and the running start of every
+    // slot's nonzeros
+    int *col_slot = malloc((train_data->colcount + 1) * sizeof(int));
+    for(unsigned int col = 0; col < train_data->colcount; col++) {
+        col_slot[col] = -1;
+    }
+    unsigned int *touched = malloc((train_data->nnz + 1) * sizeof(unsigned int));
+    unsigned long *slot_fill = malloc((train_data->nnz + 2) * sizeof(unsigned long));
+    ss_nonzero *by_col = malloc((train_data->nnz + 1) * sizeof(ss_nonzero));
+    ss_nonzero *nz = malloc((train_data->nnz + 1) * sizeof(ss_nonzero));
+    float *nz_counts = malloc(2 * classcount * sizeof(float));
+    float *lesser = malloc(classcount * sizeof(float));
+    float *greater = malloc(classcount * sizeof(float));
+    int leaves = 0;
+
+    while(opencount > 0) {
+        int *split_col = malloc(opencount * sizeof(int));
+        float *split_value = malloc(opencount * sizeof(float));
+
+        // nodes with only one class left are leaves
+        for(int o = 0; o < opencount; o++) {
+            float *counts = &open_counts[o * classcount];
+            int present = 0;
+            for(int c = 0; c < classcount; c++) {
+                if(counts[c] > 0) {
+                    present += 1;
+                }
+            }
+            int majority = ss_majority(counts, classcount);
+            float total = 0;
+            for(int c = 0; c < classcount; c++) {
+                total += counts[c];
+            }
+            open[o]->prediction_value = classes[majority];
+            open[o]->train_error = total - counts[majority];
+            split_col[o] = present > 1 ? 0 : -1;
+        }
+
+        // bucket the nonzeros of the rows at the nodes to split by column,
+        // then by node. the columns are numbered in the order they turn up,
+        // so none of this depends on how many columns there are. both passes
+        // keep the order the nonzeros come in, so every node's nonzeros end
+        // up grouped by column, in row order within each column, which is
+        // the order their values are summed in
+        unsigned int touchedcount = 0;
+        for(unsigned int a = 0; a < activecount; a++) {
+            unsigned int row = active[a];
+            if(split_col[node_of[row]] < 0) {
+                continue;
+            }
+            for(unsigned long i = train_data->row_start[row]; i < train_data->row_start[row + 1]; i++) {
+                unsigned int col = train_data->col_index[i];
+                if(col_slot[col] < 0) {
+                    col_slot[col] = touchedcount;
+                    touched[touchedcount] = col;
+                    slot_fill[touchedcount + 1] = 0;
+                    touchedcount += 1;
+                }
+                slot_fill[col_slot[col] + 1] += 1;
+            }
+        }
+        slot_fill[0] = 0;
+        for(unsigned int t = 0; t < touchedcount; t++) {
+            slot_fill[t + 1] += slot_fill[t];
+        }
+        unsigned long *node_start = calloc(opencount + 1, sizeof(unsigned long));
+        for(unsigned int a = 0; a < activecount; a++) {
+            unsigned int row = active[a];
+            int o = node_of[row];
+            if(split_col[o] < 0) {
+                continue;
+            }
+            node_start[o + 1] += train_data->row_start[row + 1] - train_data->row_start[row];
+            for(unsigned long i = train_data->row_start[row]; i < train_data->row_start[row + 1]; i++) {
+                ss_nonzero *e = &by_col[slot_fill[col_slot[train_data->col_index[i]]]++];
+                e->col = train_data->col_index[i];
+                e->row = row;
+                e->value = train_data->values[i];
+            }
+        }
+        for(int o = 0; o < opencount; o++) {
+            node_start[o + 1] += node_start[o];
+        }
+        unsigned long nzcount = node_start[opencount];
+        unsigned long *fill = malloc((opencount + 1) * sizeof(unsigned long));
+        memcpy(fill, node_start, (opencount + 1) * sizeof(unsigned long));
+        for(unsigned long i = 0; i < nzcount; i++) {
+            nz[fill[node_of[by_col[i].row]]++] = by_col[i];
+        }
+        free(fill);
+        for(unsigned int t = 0; t < touchedcount; t++) {
+            col_slot[touched[t]] = -1;
+        }
+
+        // only the columns with nonzeros at a node are scored, a column that
+        // is all zeros there can't split it
+        for(int o = 0; o < opencount; o++) {
+            if(split_col[o] < 0) {
+                continue;
+            }
+
+            float *counts = &open_counts[o * classcount];
+            float total = 0;
+            for(int c = 0; c < classcount; c++) {
+                total += counts[c];
+            }
+            float parent = ds_entropy_counts(counts, classcount, total);
+
+            int bestcol = -1;
+            float best = 0;
+            float best_mean = 0;
+            float best_lesser_total = 0;
+            unsigned long i = node_start[o];
+            while(i < node_start[o + 1]) {
+                unsigned int col = nz[i].col;
+                unsigned long end = i;
+                double sum = 0;
+                while(end < node_start[o + 1] && nz[end].col == col) {
+                    sum += nz[end].value;
+                    end += 1;
+                }
+                // the implicit zeros count towards the mean, but add nothing
+                float mean = (float)(sum / total);
+
+                // class counts of the nonzeros on each side of the mean
+                float *nz_lesser = nz_counts;
+                float *nz_greater = nz_counts + classcount;
+                memset(nz_counts, 0, 2 * classcount * sizeof(float));
+                for(; i < end; i++) {
+                    int side = nz[i].value < mean ? 0 : 1;
+                    nz_counts[side * classcount + labels[nz[i].row]] += 1;
+                }
+
+                // every row of the node that isn't a nonzero of this column
+                // is a zero, and they all go to the same side
+                int zero_lesser = 0 < mean;
+                float lesser_total = 0;
+                for(int c = 0; c < classcount; c++) {
+                    float zeros = counts[c] - nz_lesser[c] - nz_greater[c];
+                    lesser[c] = nz_lesser[c] + (zero_lesser ? zeros : 0);
+                    greater[c] = nz_greater[c] + (zero_lesser ? 0 : zeros);
+                    lesser_total += lesser[c];
+                }
+
+                // the columns aren't in order, ties go to the lowest one
+                float gain = dt_split_gain(dt->criterion, parent, lesser, greater, classcount);
+                if(bestcol < 0 || gain > best || (gain == best && (int)col < bestcol)) {
+                    best = gain;
+                    bestcol = col;
+                    best_mean = mean;
+                    best_lesser_total = lesser_total;
+                }
+            }
+
+            if(bestcol < 0 || best_lesser_total == 0 || best_lesser_total == total) {
+                // nothing separates these rows, keep the majority class
+                split_col[o] = -1;
+            }
+            else {
+                split_col[o] = bestcol;
+                split_value[o] = best_mean;
+            }
+        }
+        free(node_start);
+
+        // make the children of every node that split, and the leaves
+        int nextcount = 0;
+        int *child_of = malloc(opencount * sizeof(int));
+        for(int o = 0; o < opencount; o++) {
+            dt_node *node = open[o];
+            if(split_col[o] < 0) {
+                node->is_leaf = 1;
+                child_of[o] = -1;
+                leaves += 1;
+                continue;
+            }
+
+            node->split_col = split_col[o];
+            node->split_value = split_value[o];
+            node->left = dt_new_node();
+            node->left->is_lesser = 1;
+            node->left->parent = node;
+            node->right = dt_new_node();
+            node->right->is_lesser = 0;
+            node->right->parent = node;
+            child_of[o] = nextcount;
+            nextcount += 2;
+        }
+
+        dt_node **next = malloc((nextcount + 1) * sizeof(dt_node*));
+        float *next_counts = calloc((long)nextcount * classcount + 1, sizeof(float));
+        for(int o = 0; o < opencount; o++) {
+            if(child_of[o] >= 0) {
+                next[child_of[o]] = open[o]->left;
+                next[child_of[o] + 1] = open[o]->right;
+            }
+        }
+
+        // send every row down to its child on the next level, dropping the
+        // rows that reached a leaf
+        unsigned int kept = 0;
+        for(unsigned int a = 0; a < activecount; a++) {
+            unsigned int row = active[a];
+            int o = node_of[row];
+            if(child_of[o] < 0) {
+                node_of[row] = -1;
+                continue;
+            }
+            float value = ss_value(train_data, row, split_col[o]);
+            int child = child_of[o] + (value < split_value[o] ? 0 : 1);
+            node_of[row] = child;
+            next_counts[child * classcount + labels[row]] += 1;
+            active[kept++] = row;
+        }
+        activecount = kept;
+
+        free(child_of);
+        free(split_col);
+        free(split_value);
+        free(open);
+        free(open_counts);
+        open = next;
+        open_counts = next_counts;
+        opencount = nextcount;
+    }
+
+    free(open);
+    free(open_counts);
+    free(active);
+    free(col_slot);
+    free(touched);
+    free(slot_fill);
+    free(by_col);
+    free(nz);
+    free(nz_counts);
+    free(lesser);
+    free(greater);
+    free(node_of);
+    free(labels);
+    free(classes);
+
+    printf("Decision tree has %d nodes\n", leaves);
+    return 0;
+}
+
+float* dt_predict_sparse(decision_tree *dt, sparse_set *test_data) {
+    float *preds = malloc(test_data->rowcount * sizeof(float));
+    for(unsigned int i = 0; i < test_data->rowcount; i++) {
+        preds[i] = ss_classify(dt, test_data, i);
+    }
+    return preds;
+}
+
+// private function, same as dt_classify for a sparse row
+float ss_classify(decision_tree *dt, sparse_set *data, unsigned int row) {
+    dt_node *node = dt->root;
+    while(!node->is_leaf) {
+        dt_node *first = node->right;
+        dt_node *second = node->left;
+        if(dt_goes_left(node, ss_value(data, row, node->split_col))) {
+            first = node->left;
+            second = node->right;
+        }
+
+        node = first != NULL ? first : second;
+        if(node == NULL) {
+            return 2;
+        }
+    }
+    return node->prediction_value;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include "decision_tree.h"
+
+// a data set that only stores the nonzero feature values
+// rows are stored in CSR form
+typedef struct sparse_set {
+    unsigned int colcount;
+    unsigned int rowcount;
+    unsigned long nnz;
+    int has_ydata;
+    float *y_data;
+
+    // the nonzeros of row i are at row_start[i] up to row_start[i+1],
+    // sorted by column
+    unsigned long *row_start;
+    unsigned int *col_index;
+    float *values;
+} sparse_set;
+
+// read a libsvm/svmlight formatted file
+// every line is "<label> <index>:<value> <index>:<value> ...", with indices
+// starting at 1. the label is stored as the y value, and colcount is the
+// highest index seen. explicit zeros are dropped
+sparse_set* ss_new_from_libsvm(char *filename);
+
+// free the sparse set
+void ss_free(sparse_set *ss);
+
+// the value at row, col (0 for anything that isn't stored)
+float ss_value(sparse_set *ss, unsigned int row, unsigned int col);
+
+// train a decision tree on sparse data
+// makes the same mean-based splits as dt_train, but each level of the tree
+// is grown from the stored nonzeros of the rows that haven't reached a leaf:
+// they are bucketed by the node their row sits at, and only the columns with
+// nonzeros at a node are scored, the implicit zeros of a column being
+// counted as one bucket. a level takes time in the number of those rows and
+// nonzeros, not columns. nodes whose best split would leave one side empty
+// become leaves
+int dt_train_sparse(decision_tree *dt, sparse_set *train_data);
+
+// same as dt_predict, for sparse rows
+float* dt_predict_sparse(decision_tree *dt, sparse_set *test_data);
@@ -0,0 +1,227 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "sweep.h"
+
+// the configurations that share one trained tree
+typedef struct sweep_task {
+    split_criterion criterion;
+    int max_depth;
+    int *configs;
+    int count;
+} sweep_task;
+
+// one in this many training rows is held out to prune against
+#define SWEEP_PRUNE_EVERY 5
+
+typedef struct sweep_state {
+    // all of the training rows, for the unpruned configurations
+    dt_prepared *prep;
+    // the training rows that aren't held out, for the pruned ones (NULL if
+    // there are too few rows to hold any out)
+    dt_prepared *prune_prep;
+    data_set *train_data;
+    unsigned int *prune_rows;
+    unsigned int prune_count;
+    data_set *validation_data;
+    dt_sweep_config *configs;
+    dt_sweep_result *results;
+    sweep_task *tasks;
+    int taskcount;
+    pthread_mutex_t lock;
+    int next_task;
+} sweep_state;
+
+void* sweep_worker(void *arg);
+void sweep_run(sweep_state *state, sweep_task *task, int prune);
+int sweep_compare_results(const void *a, const void *b);
+
+double sweep_now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+dt_sweep_result* dt_sweep(data_set *train_data, data_set *validation_data,
+        dt_sweep_config *configs, int count, int threads) {
+    if(!validation_data->has_ydata) {
+        fprintf(stderr, "Scoring data must have y data!\n");
+        return NULL;
+    }
+
+    dt_prepared *prep = dt_prepare(train_data, NULL, train_data->rowcount);
+    if(prep == NULL || count < 1) {
+        dt_prepared_free(prep);
+        return NULL;
+    }
+
+    // pruning against the validation set would tune the pruned trees to the
+    // rows they are scored on, so they are trained without every
+    // SWEEP_PRUNE_EVERY'th training row and pruned against those instead
+    int any_prune = 0;
+    for(int i = 0; i < count; i++) {
+        any_prune |= configs[i].prune;
+    }
+    dt_prepared *prune_prep = NULL;
+    unsigned int *prune_rows = NULL;
+    unsigned int prune_count = 0;
+    if(any_prune && train_data->rowcount > 1) {
+        unsigned int every = train_data->rowcount >= SWEEP_PRUNE_EVERY ? SWEEP_PRUNE_EVERY : 2;
+        unsigned int *fit_rows = malloc(train_data->rowcount * sizeof(unsigned int));
+        unsigned int fit_count = 0;
+        prune_rows = malloc(train_data->rowcount * sizeof(unsigned int));
+        for(unsigned int i = 0; i < train_data->rowcount; i++) {
+            if(i % every == every - 1) {
+                prune_rows[prune_count] = i;
+                prune_count += 1;
+            }
+            else {
+                fit_rows[fit_count] = i;
+                fit_count += 1;
+            }
+        }
+        prune_prep = dt_prepare(train_data, fit_rows, fit_count);
+        free(fit_rows);
+    }
+
+    // group the configurations by everything but pruning
+    sweep_task *tasks = malloc(count * sizeof(sweep_task));
+    int taskcount = 0;
+    for(int i = 0; i < count; i++) {
+        int t = 0;
+        while(t < taskcount && (tasks[t].criterion != configs[i].criterion ||
+                    tasks[t].max_depth != configs[i].max_depth)) {
+            t += 1;
+        }
+        if(t == taskcount) {
+            tasks[t].criterion = configs[i].criterion;
+            tasks[t].max_depth = configs[i].max_depth;
+            tasks[t].configs = malloc(count * sizeof(int));
+            tasks[t].count = 0;
+            taskcount += 1;
+        }
+        tasks[t].configs[tasks[t].count] = i;
+        tasks[t].count += 1;
+    }
+
+    sweep_state state;
+    state.prep = prep;
+    state.prune_prep = prune_prep;
+    state.train_data = train_data;
+    state.prune_rows = prune_rows;
+    state.prune_count = prune_count;
+    state.validation_data = validation_data;
+    state.configs = configs;
+    state.results = malloc(count * sizeof(dt_sweep_result));
+    state.tasks = tasks;
+    state.taskcount = taskcount;
+    state.next_task = 0;
+    pthread_mutex_init(&state.lock, NULL);
+
+    if(threads < 1 || threads > taskcount) {
+        threads = taskcount;
+    }
+    pthread_t *ids = malloc(threads * sizeof(pthread_t));
+    for(int t = 0; t < threads; t++) {
+        pthread_create(&ids[t], NULL, sweep_worker, &state);
+    }
+    for(int t = 0; t < threads; t++) {
+        pthread_join(ids[t], NULL);
+    }
+    free(ids);
+
+    qsort(state.results, count, sizeof(dt_sweep_result), sweep_compare_results);
+
+    pthread_mutex_destroy(&state.lock);
+    for(int t = 0; t < taskcount; t++) {
+        free(tasks[t].configs);
+    }
+    free(tasks);
+    dt_prepared_free(prep);
+    dt_prepared_free(prune_prep);
+    free(prune_rows);
+    return state.results;
+}
+
+// private function, trains trees until every task is done
+void* sweep_worker(void *arg) {
+    sweep_state *state = arg;
+
+    while(1) {
+        pthread_mutex_lock(&state->lock);
+        int t = state->next_task;
+        state->next_task += 1;
+        pthread_mutex_unlock(&state->lock);
+        if(t >= state->taskcount) {
+            break;
+        }
+
+        sweep_task *task = &state->tasks[t];
+        int wants_prune = 0;
+        int wants_noprune = 0;
+        for(int i = 0; i < task->count; i++) {
+            if(state->configs[task->configs[i]].prune) {
+                wants_prune = 1;
+            }
+            else {
+                wants_noprune = 1;
+            }
+        }
+        if(wants_noprune) {
+            sweep_run(state, task, 0);
+        }
+        if(wants_prune) {
+            sweep_run(state, task, 1);
+        }
+    }
+
+    return NULL;
+}
+
+// private function, trains the tree of task, pruned or not, scores it on
+// the validation set and fills in the results of the matching configurations
+void sweep_run(sweep_state *state, sweep_task *task, int prune) {
+    decision_tree *dt = dt_new(0, task->criterion);
+    dt->max_depth = task->max_depth;
+
+    dt_prepared *prep = prune && state->prune_prep != NULL ? state->prune_prep : state->prep;
+    double start = sweep_now_ms();
+    dt_train_prepared(dt, prep);
+    double train_ms = sweep_now_ms() - start;
+
+    double prune_ms = 0;
+    if(prune && state->prune_count > 0) {
+        start = sweep_now_ms();
+        dt_prune_rows(dt, state->train_data, state->prune_rows, state->prune_count);
+        prune_ms = sweep_now_ms() - start;
+    }
+
+    int nodes = dt_node_count(dt);
+    float score = dt_score(dt, state->validation_data);
+    for(int i = 0; i < task->count; i++) {
+        int c = task->configs[i];
+        if(state->configs[c].prune != prune) {
+            continue;
+        }
+        dt_sweep_result *r = &state->results[c];
+        r->config = state->configs[c];
+        r->score = score;
+        r->nodes = nodes;
+        r->train_ms = train_ms;
+        r->prune_ms = prune_ms;
+    }
+
+    dt_free(dt);
+}
+
+int sweep_compare_results(const void *a, const void *b) {
+    const dt_sweep_result *ra = a;
+    const dt_sweep_result *rb = b;
+    if(ra->score != rb->score) {
+        return ra->score < rb->score ? 1 : -1;
+    }
+    return (ra->nodes > rb->nodes) - (ra->nodes < rb->nodes);
+}
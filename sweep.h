@@ -0,0 +1,32 @@
+#pragma once
+
+#include "decision_tree.h"
+
+typedef struct dt_sweep_config {
+    split_criterion criterion;
+    int prune;
+    // see decision_tree.max_depth, 0 means no limit
+    int max_depth;
+} dt_sweep_config;
+
+typedef struct dt_sweep_result {
+    dt_sweep_config config;
+    // dt_score on the validation set, after pruning if the config prunes
+    float score;
+    int nodes;
+    // wall clock time spent training and pruning the tree
+    double train_ms;
+    double prune_ms;
+} dt_sweep_result;
+
+// train and score every configuration on the same data
+// the training rows are prepared (dt_prepare) once for the whole grid.
+// pruned configurations are trained without every 5th training row and
+// pruned against those, so that every score is measured on validation rows
+// that no tree was fitted or pruned to. configurations that only differ in
+// pruning are trained one after the other by the same thread. up to
+// `threads` of those pairs run at once, 0 means one thread per pair
+// returns an array of count results, ranked best score first (fewer nodes
+// first on ties). it should be freed after use
+dt_sweep_result* dt_sweep(data_set *train_data, data_set *validation_data,
+        dt_sweep_config *configs, int count, int threads);
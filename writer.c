@@ -0,0 +1,215 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "writer.h"
+
+#define WR_BUFSIZE (1 << 20)
+// room for the longest csv line: two 64 bit numbers, a comma and a newline
+#define WR_MAX_LINE 48
+
+// predictions waiting for the writer thread
+typedef struct wr_chunk {
+    float *preds;
+    size_t count;
+    struct wr_chunk *next;
+} wr_chunk;
+
+struct writer {
+    char *filename;
+    FILE *f;
+    int format;
+    // formatted output waiting to be written, buf[0] up to buf[len]
+    char *buf;
+    size_t len;
+    // the number of the next csv row
+    unsigned long id;
+    int failed;
+
+    // the queue of chunks, head is the oldest. closing is set by wr_close,
+    // after which the writer thread stops once the queue is empty
+    wr_chunk *head;
+    wr_chunk *tail;
+    int closing;
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_t thread;
+};
+
+void* wr_run(void *arg);
+void wr_format(writer *wr, const float *preds, size_t count);
+void wr_flush(writer *wr);
+int wr_format_int(char *out, long value);
+
+writer* wr_open(char *filename, int format) {
+    FILE *f = fopen(filename, "wb");
+    if(!f) {
+        fprintf(stderr, "Unable to open file '%s'\n", filename);
+        return NULL;
+    }
+    // the writer thread only ever writes whole blocks
+    setvbuf(f, NULL, _IONBF, 0);
+
+    writer *wr = malloc(sizeof(writer));
+    wr->filename = malloc(strlen(filename) + 1);
+    strcpy(wr->filename, filename);
+    wr->f = f;
+    wr->format = format;
+    wr->buf = malloc(WR_BUFSIZE);
+    wr->len = 0;
+    wr->id = 1;
+    wr->failed = 0;
+    if(format == WR_CSV) {
+        strcpy(wr->buf, "Id,Prediction\n");
+        wr->len = strlen(wr->buf);
+    }
+
+    wr->head = NULL;
+    wr->tail = NULL;
+    wr->closing = 0;
+    pthread_mutex_init(&wr->lock, NULL);
+    pthread_cond_init(&wr->not_empty, NULL);
+    pthread_create(&wr->thread, NULL, wr_run, wr);
+    return wr;
+}
+
+void wr_write(writer *wr, const float *preds, size_t count) {
+    if(count == 0) {
+        return;
+    }
+    wr_chunk *chunk = malloc(sizeof(wr_chunk));
+    chunk->preds = malloc(count * sizeof(float));
+    memcpy(chunk->preds, preds, count * sizeof(float));
+    chunk->count = count;
+    chunk->next = NULL;
+
+    pthread_mutex_lock(&wr->lock);
+    if(wr->tail != NULL) {
+        wr->tail->next = chunk;
+    }
+    else {
+        wr->head = chunk;
+    }
+    wr->tail = chunk;
+    pthread_cond_signal(&wr->not_empty);
+    pthread_mutex_unlock(&wr->lock);
+}
+
+int wr_close(writer *wr) {
+    if(wr == NULL) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&wr->lock);
+    wr->closing = 1;
+    pthread_cond_signal(&wr->not_empty);
+    pthread_mutex_unlock(&wr->lock);
+    pthread_join(wr->thread, NULL);
+    pthread_mutex_destroy(&wr->lock);
+    pthread_cond_destroy(&wr->not_empty);
+
+    if(fclose(wr->f) != 0) {
+        wr->failed = 1;
+    }
+    int failed = wr->failed;
+    if(failed) {
+        fprintf(stderr, "Failed to write '%s'\n", wr->filename);
+    }
+    free(wr->buf);
+    free(wr->filename);
+    free(wr);
+    return failed ? -1 : 0;
+}
+
+// private function, the writer thread: formats the queued chunks in order
+// until wr_close has been called and the queue is empty
+void* wr_run(void *arg) {
+    writer *wr = arg;
+    while(1) {
+        pthread_mutex_lock(&wr->lock);
+        while(wr->head == NULL && !wr->closing) {
+            pthread_cond_wait(&wr->not_empty, &wr->lock);
+        }
+        wr_chunk *chunk = wr->head;
+        if(chunk != NULL) {
+            wr->head = chunk->next;
+            if(wr->head == NULL) {
+                wr->tail = NULL;
+            }
+        }
+        pthread_mutex_unlock(&wr->lock);
+
+        if(chunk == NULL) {
+            break;
+        }
+        wr_format(wr, chunk->preds, chunk->count);
+        free(chunk->preds);
+        free(chunk);
+    }
+    wr_flush(wr);
+    return NULL;
+}
+
+// private function, adds count predictions to the output buffer, writing
+// it out whenever it fills up
+void wr_format(writer *wr, const float *preds, size_t count) {
+    if(wr->format == WR_RAW) {
+        size_t done = 0;
+        while(done < count) {
+            size_t room = (WR_BUFSIZE - wr->len) / sizeof(float);
+            if(room == 0) {
+                wr_flush(wr);
+                continue;
+            }
+            size_t take = count - done < room ? count - done : room;
+            memcpy(wr->buf + wr->len, preds + done, take * sizeof(float));
+            wr->len += take * sizeof(float);
+            done += take;
+        }
+        return;
+    }
+
+    for(size_t i = 0; i < count; i++) {
+        if(wr->len + WR_MAX_LINE > WR_BUFSIZE) {
+            wr_flush(wr);
+        }
+        char *out = wr->buf + wr->len;
+        int n = wr_format_int(out, wr->id);
+        out[n++] = ',';
+        n += wr_format_int(out + n, (int)preds[i]);
+        out[n++] = '\n';
+        wr->len += n;
+        wr->id += 1;
+    }
+}
+
+// private function, writes the output buffer to the file in one go
+void wr_flush(writer *wr) {
+    if(wr->len > 0 && !wr->failed && fwrite(wr->buf, 1, wr->len, wr->f) != wr->len) {
+        wr->failed = 1;
+    }
+    wr->len = 0;
+}
+
+// private function, writes value in decimal to out (without a terminating
+// null), returns the number of characters written
+int wr_format_int(char *out, long value) {
+    char digits[24];
+    int n = 0;
+    unsigned long v = value < 0 ? -(unsigned long)value : (unsigned long)value;
+    do {
+        digits[n++] = '0' + v % 10;
+        v /= 10;
+    } while(v > 0);
+
+    int len = 0;
+    if(value < 0) {
+        out[len++] = '-';
+    }
+    while(n > 0) {
+        out[len++] = digits[--n];
+    }
+    return len;
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <stddef.h>
+
+// prediction output file, formatted and written on a thread of its own
+// predictions are handed over a chunk at a time and queued without limit,
+// so handing them over never waits for the disk. the writer thread formats
+// them into large blocks, which go to the file with one write each
+typedef struct writer writer;
+
+// "Id,Prediction" csv, one "<row number>,<class>" line per prediction, with
+// rows numbered from 1
+#define WR_CSV 0
+// the predictions as native endian 32 bit floats, one per row in row order
+// and nothing else, for programs that read them back without parsing
+#define WR_RAW 1
+
+// open filename for writing in one of the formats above
+// returns NULL (after printing why) on failure
+writer* wr_open(char *filename, int format);
+
+// queue count predictions, for the rows after the ones already queued
+// preds is copied, so it can be reused as soon as this returns
+void wr_write(writer *wr, const float *preds, size_t count);
+
+// write out everything that was queued and close the file
+// returns 0 if all of it was written without errors
+int wr_close(writer *wr);